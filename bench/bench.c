@@ -0,0 +1,387 @@
+/*
+ * Loopback benchmark for the TLS shims in ../src, built natively (not to wasm) by ../buildnative.sh,
+ * once per engine and build mode, and linked against system WolfSSL and BearSSL.
+ *
+ * Each connection runs over a socketpair to a WolfSSL server on another thread, which uses the
+ * certs made by gencert.sh. After the handshake, the client sends 9-byte commands: 'U' + a 64-bit
+ * big-endian length, after which the client sends that many bytes and the server replies with one
+ * byte; or 'D' + length, after which the server sends that many bytes.
+ *
+ * Reports handshake latency (full and resumed), throughput in each direction, and allocations and
+ * network reads per MB transferred (in the wasm build, each network read that finds nothing already
+ * queued is an ASYNCIFY suspension). Allocations are counted on the client thread only: the shim's own via the linker's
+ * --wrap, and WolfSSL's via wolfSSL_SetAllocators (BearSSL doesn't allocate). The same hooks give the
+ * peak heap held by the client for one connection, from tlsOpen through all the transfers: a guide
+ * to the wasm heap per connection, though native pointers and allocator overheads are bigger. The
+ * static-memory build allocates from its own arena instead, and reports that via tlsStats.
+ *
+ * usage: bench-<engine>-<mode> certdir [handshakes]
+ */
+
+#include <malloc.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <wolfssl/options.h>
+#include <wolfssl/ssl.h>
+
+#include "platform.h"
+#include "stats.h"
+
+#define TLS_WANT_READ -2
+#define HOST "localhost"
+#define CHUNK 16384
+
+// === The shim's exported API (see src/wolfssl.c and src/bearssl.c) ===
+
+int tlsOpen(char *host, const unsigned char *rootCert, int rootCertLength, int disableSNI);
+int tlsConnect(int id);
+#ifdef BENCH_BEARSSL
+  int writeData(int id, unsigned char *buf, size_t len);
+#else
+  int writeData(int id, char *buf, int len);
+#endif
+int readDataInPlace(int id);
+unsigned char *readDataPointer(int id);
+int tlsSetSession(int id, const unsigned char *data, int len);
+int tlsGetSession(int id, unsigned char *buf, int len);
+int tlsSessionReused(int id);
+TlsStats *tlsStats(int id);
+void tlsClose(int id);
+#ifdef NONBLOCKING
+  unsigned char *encryptedInputBuffer(int id, int len);
+  int feedEncrypted(int id, int len);
+  int pendingEncrypted(int id);
+  unsigned char *encryptedOutputBuffer(int id);
+  int takeEncrypted(int id, int len);
+#endif
+
+// === Allocation counting ===
+
+static __thread int counting;  // set on the client thread only
+static size_t allocations;
+static __thread int tracking;  // likewise: heap in use, for the peak per connection
+static long heapInUse, heapPeak;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *p, size_t size);
+void __real_free(void *p);
+
+static void track(void *p, int sign) {
+  if (!tracking || p == NULL) return;
+  heapInUse += sign * (long)malloc_usable_size(p);
+  if (heapInUse > heapPeak) heapPeak = heapInUse;
+}
+
+void *__wrap_malloc(size_t size) {
+  if (counting) allocations++;
+  void *p = __real_malloc(size);
+  track(p, 1);
+  return p;
+}
+
+void *__wrap_calloc(size_t n, size_t size) {
+  if (counting) allocations++;
+  void *p = __real_calloc(n, size);
+  track(p, 1);
+  return p;
+}
+
+void *__wrap_realloc(void *p, size_t size) {
+  if (counting) allocations++;
+  track(p, -1);
+  p = __real_realloc(p, size);
+  track(p, 1);
+  return p;
+}
+
+void __wrap_free(void *p) {
+  track(p, -1);
+  __real_free(p);
+}
+
+static void *wolfMalloc(size_t size) {
+  return __wrap_malloc(size);
+}
+
+static void *wolfRealloc(void *p, size_t size) {
+  return __wrap_realloc(p, size);
+}
+
+static void wolfFree(void *p) {
+  __wrap_free(p);
+}
+
+// === Server ===
+
+static WOLFSSL_CTX *serverCtx;
+
+static int readFully(WOLFSSL *ssl, unsigned char *buf, int len) {
+  for (int got = 0; got < len; ) {
+    int n = wolfSSL_read(ssl, buf + got, len - got);
+    if (n <= 0) return -1;
+    got += n;
+  }
+  return 0;
+}
+
+static void *serve(void *arg) {
+  int fd = (int)(intptr_t)arg;
+  static __thread unsigned char buf[CHUNK];
+
+  WOLFSSL *ssl = wolfSSL_new(serverCtx);
+  wolfSSL_set_fd(ssl, fd);
+  if (wolfSSL_accept(ssl) != WOLFSSL_SUCCESS) goto done;
+
+  unsigned char cmd[9];
+  while (readFully(ssl, cmd, sizeof cmd) == 0) {
+    uint64_t len = 0;
+    for (int i = 1; i < 9; i++) len = len << 8 | cmd[i];
+
+    if (cmd[0] == 'U') {
+      for (uint64_t got = 0; got < len; ) {
+        int n = wolfSSL_read(ssl, buf, len - got < CHUNK ? len - got : CHUNK);
+        if (n <= 0) goto done;
+        got += n;
+      }
+      if (wolfSSL_write(ssl, "k", 1) != 1) goto done;
+
+    } else if (cmd[0] == 'D') {
+      memset(buf, 'd', CHUNK);
+      for (uint64_t sent = 0; sent < len; ) {
+        int n = len - sent < CHUNK ? len - sent : CHUNK;
+        if (wolfSSL_write(ssl, buf, n) != n) goto done;
+        sent += n;
+      }
+    }
+  }
+
+done:
+  wolfSSL_free(ssl);
+  close(fd);
+  return NULL;
+}
+
+// === Client ===
+
+#ifdef NONBLOCKING
+  static void sendPending(int id) {
+    int len = pendingEncrypted(id);
+    if (len == 0) return;
+    platformSend(id, encryptedOutputBuffer(id), len);
+    takeEncrypted(id, len);
+  }
+
+  static void receiveMore(int id) {
+    unsigned char *buf = encryptedInputBuffer(id, CHUNK);
+    int len = platformRecv(id, buf, CHUNK);
+    feedEncrypted(id, len < 0 ? 0 : len);
+  }
+
+  // repeats a call for as long as it needs more input, moving ciphertext to and from the socket
+  #define DRIVE(id, result, call) do { \
+      while ((result = (call)) == TLS_WANT_READ) { sendPending(id); receiveMore(id); } \
+      sendPending(id); \
+    } while (0)
+#else
+  #define DRIVE(id, result, call) result = (call)
+#endif
+
+static unsigned char *rootCert;
+static int rootCertLength;
+static unsigned char session[4096];
+static int sessionLength;
+static int clientFds[MAX_CONNECTIONS];
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int clientWrite(int id, const unsigned char *buf, size_t len) {
+  for (size_t written = 0; written < len; ) {
+    int n;
+    DRIVE(id, n, writeData(id, (void *)(buf + written), len - written));
+    if (n < 0) return -1;
+    #ifdef NONBLOCKING
+      written += n;
+    #else
+      written = len;  // in blocking mode, it's all or nothing
+    #endif
+  }
+  return 0;
+}
+
+static int clientRead(int id, size_t len) {  // reads and discards exactly len bytes
+  for (size_t got = 0; got < len; ) {
+    int n;
+    DRIVE(id, n, readDataInPlace(id));
+    if (n <= 0) return -1;
+    got += n;
+  }
+  return 0;
+}
+
+static int command(int id, char type, uint64_t len) {
+  unsigned char cmd[9] = { type };
+  for (int i = 8; i > 0; i--, len >>= 8) cmd[i] = len & 0xff;
+  return clientWrite(id, cmd, sizeof cmd);
+}
+
+// connects, optionally resuming the last saved session; returns the connection id, or -1
+static int connectToServer(int resume, double *handshakeSeconds, pthread_t *server) {
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) return -1;
+  pthread_create(server, NULL, serve, (void *)(intptr_t)fds[1]);
+
+  double start = now();
+  int id = tlsOpen(HOST, rootCert, rootCertLength, 0);
+  if (id < 0) return -1;
+  platformSetSocket(id, fds[0]);
+  clientFds[id] = fds[0];
+  if (resume && sessionLength > 0) tlsSetSession(id, session, sessionLength);
+
+  int status;
+  DRIVE(id, status, tlsConnect(id));
+  *handshakeSeconds = now() - start;
+  if (status != 0) return -1;
+
+  // a round trip, so that any TLS 1.3 ticket has arrived before we save the session
+  if (command(id, 'U', 0) != 0 || clientRead(id, 1) != 0) return -1;
+  int len = tlsGetSession(id, session, sizeof session);
+  if (len > 0) sessionLength = len;
+  return id;
+}
+
+static void disconnect(int id, pthread_t server) {  // closing our end ends the server thread
+  tlsClose(id);
+  close(clientFds[id]);
+  pthread_join(server, NULL);
+}
+
+static int compareDoubles(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return x < y ? -1 : x > y;
+}
+
+static void benchHandshakes(int count, int resume) {
+  double *times = calloc(count, sizeof(double));
+  int reused = 0;
+
+  for (int i = 0; i < count; i++) {
+    pthread_t server;
+    int id = connectToServer(resume, &times[i], &server);
+    if (id < 0) {
+      fprintf(stderr, "handshake failed\n");
+      exit(1);
+    }
+    reused += tlsSessionReused(id);
+    disconnect(id, server);
+  }
+
+  qsort(times, count, sizeof(double), compareDoubles);
+  printf("  %s handshake: median %.2f ms, p90 %.2f ms (%d of %d resumed)\n",
+    resume ? "resumed" : "full", times[count / 2] * 1e3, times[count * 9 / 10] * 1e3, reused, count);
+  free(times);
+}
+
+static void benchTransfer(int id, char direction, size_t len) {
+  static unsigned char buf[CHUNK];
+  memset(buf, 'u', sizeof buf);
+
+  uint32_t readsBefore = tlsStats(id)->networkReads;
+  allocations = 0;
+  counting = 1;
+  double start = now();
+
+  int failed = command(id, direction, len) != 0;
+  if (!failed && direction == 'U') {
+    for (size_t sent = 0; sent < len && !failed; sent += CHUNK) {
+      failed = clientWrite(id, buf, len - sent < CHUNK ? len - sent : CHUNK) != 0;
+    }
+    if (!failed) failed = clientRead(id, 1) != 0;
+  } else if (!failed) {
+    failed = clientRead(id, len) != 0;
+  }
+
+  double seconds = now() - start;
+  counting = 0;
+  if (failed) {
+    fprintf(stderr, "transfer failed\n");
+    exit(1);
+  }
+
+  double mb = len / 1048576.0;
+  printf("  %-8s %9zu bytes: %8.1f MB/s, %7.1f allocs/MB, %7.1f reads/MB\n",
+    direction == 'U' ? "upload" : "download", len, mb / seconds, allocations / mb,
+    (tlsStats(id)->networkReads - readsBefore) / mb);
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s certdir [handshakes]\n", argv[0]);
+    return 1;
+  }
+  int handshakes = argc > 2 ? atoi(argv[2]) : 50;
+
+  char path[4096];
+  snprintf(path, sizeof path, "%s/ca.pem", argv[1]);
+  FILE *f = fopen(path, "rb");
+  if (f == NULL) {
+    perror(path);
+    return 1;
+  }
+  rootCert = malloc(65536);
+  rootCertLength = fread(rootCert, 1, 65536, f);
+  fclose(f);
+
+  wolfSSL_Init();
+  wolfSSL_SetAllocators(wolfMalloc, wolfFree, wolfRealloc);
+
+  serverCtx = wolfSSL_CTX_new(wolfSSLv23_server_method());
+  snprintf(path, sizeof path, "%s/server.pem", argv[1]);
+  if (wolfSSL_CTX_use_certificate_chain_file(serverCtx, path) != WOLFSSL_SUCCESS) {
+    fprintf(stderr, "can't load %s\n", path);
+    return 1;
+  }
+  snprintf(path, sizeof path, "%s/server.key", argv[1]);
+  if (wolfSSL_CTX_use_PrivateKey_file(serverCtx, path, WOLFSSL_FILETYPE_PEM) != WOLFSSL_SUCCESS) {
+    fprintf(stderr, "can't load %s\n", path);
+    return 1;
+  }
+
+  printf("%s\n", argv[0]);
+  benchHandshakes(handshakes, 0);
+  benchHandshakes(handshakes, 1);
+
+  pthread_t server;
+  double handshakeSeconds;
+  tracking = 1;
+  int id = connectToServer(0, &handshakeSeconds, &server);
+  if (id < 0) {
+    fprintf(stderr, "connection failed\n");
+    return 1;
+  }
+
+  static const size_t sizes[] = { 1024, 16384, 262144, 1048576, 16777216 };
+  for (size_t i = 0; i < sizeof sizes / sizeof sizes[0]; i++) {
+    benchTransfer(id, 'U', sizes[i]);
+    benchTransfer(id, 'D', sizes[i]);
+  }
+  tracking = 0;
+  printf("  peak heap for one connection: %ld bytes\n", heapPeak);
+  #ifdef STATIC_MEMORY  // the arena (and pools) aren't malloc'd, so they count themselves
+    printf("  static memory for one connection: %u bytes at peak, in %u allocations\n",
+      tlsStats(id)->heapPeak, tlsStats(id)->heapAllocs);
+  #endif
+
+  disconnect(id, server);
+  return 0;
+}
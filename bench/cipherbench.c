@@ -0,0 +1,79 @@
+/*
+ * Throughput of the BearSSL record-layer primitives that each build profile uses, run under node by
+ * cipherbench.sh once per profile (-Oz, and -O3 -msimd128), so the two can be compared.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "bearssl.h"
+
+#ifdef __wasm_simd128__
+  uint32_t chacha20SimdRun(const void *key, const void *iv, uint32_t cc, void *data, size_t len);
+#endif
+
+#define RECORD 16384
+#define TOTAL (64 << 20)
+
+static unsigned char buf[RECORD];
+static const unsigned char key[32] = { 1, 2, 3 }, iv[12] = { 4, 5, 6 };
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char *name, double start) {
+  printf("  %-24s %8.1f MB/s\n", name, TOTAL / 1048576.0 / (now() - start));
+}
+
+static void benchChacha(const char *name, br_chacha20_run run) {
+  double start = now();
+  for (int i = 0; i < TOTAL / RECORD; i++) run(key, iv, 1, buf, RECORD);
+  report(name, start);
+}
+
+static void benchPoly1305(const char *name, br_poly1305_run run) {
+  unsigned char tag[16];
+  double start = now();
+  for (int i = 0; i < TOTAL / RECORD; i++) run(key, iv, buf, RECORD, buf, 13, tag, br_chacha20_ct_run, 1);
+  report(name, start);
+}
+
+static void benchGhash(const char *name, br_ghash ghash) {
+  unsigned char y[16] = { 0 };
+  double start = now();
+  for (int i = 0; i < TOTAL / RECORD; i++) ghash(y, key, buf, RECORD);
+  report(name, start);
+}
+
+static void benchAesCtr(const char *name, const br_block_ctr_class *vtable) {
+  br_aes_gen_ctr_keys ctx;
+  vtable->init(&ctx.vtable, key, 16);
+  double start = now();
+  for (int i = 0; i < TOTAL / RECORD; i++) vtable->run(&ctx.vtable, iv, 1, buf, RECORD);
+  report(name, start);
+}
+
+int main(void) {
+  #ifdef __wasm_simd128__
+    puts("profile: simd (-O3 -msimd128)");
+  #else
+    puts("profile: size (-Oz)");
+  #endif
+
+  benchChacha("chacha20 ct", br_chacha20_ct_run);
+  #ifdef __wasm_simd128__
+    benchChacha("chacha20 simd", chacha20SimdRun);
+  #endif
+  benchPoly1305("poly1305 ctmul", br_poly1305_ctmul_run);
+  benchPoly1305("poly1305 ctmul32", br_poly1305_ctmul32_run);
+  benchGhash("ghash ctmul", br_ghash_ctmul);
+  benchGhash("ghash ctmul64", br_ghash_ctmul64);
+  benchAesCtr("aes-128-ctr ct", &br_aes_ct_ctr_vtable);
+  benchAesCtr("aes-128-ctr ct64", &br_aes_ct64_ctr_vtable);
+  return 0;
+}
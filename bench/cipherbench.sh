@@ -0,0 +1,17 @@
+#!/usr/bin/env zsh -e
+
+# usage: bench/cipherbench.sh
+# Compares BearSSL record-layer throughput between the size and SIMD build profiles, under node
+# (see bench/cipherbench.c); run from the repo root, with emscripten activated
+
+mkdir -p build/cipherbench
+
+for profile in size simd; do
+  OPTFLAGS=(-Oz)
+  [ $profile = simd ] && OPTFLAGS=(-O3 -msimd128)
+
+  emcc bench/cipherbench.c src/chacha20_simd.c $(find ../BearSSL/src -name \*.c) \
+    -I../BearSSL/inc -I../BearSSL/src -Isrc \
+    -o build/cipherbench/$profile.js -sENVIRONMENT=node $OPTFLAGS
+  node build/cipherbench/$profile.js
+done
@@ -0,0 +1,104 @@
+#!/usr/bin/env node
+
+// usage: node bench/e2e/bench.mjs [options] certdir pgdir...
+//   --rtt 0,20,80     injected round-trip times to run at, in ms (default: 0,20)
+//   --connects 10     sequential connections to time (the first is cold)
+//   --queries 200     sequential SELECT 1s to time, on one connection
+//   --bulk-mb 16      size of the streamed bulk result
+//   --mux 1           share one multiplexed WebSocket per request between connections (see src/wsmux.ts)
+//   --direct 1        negotiate TLS directly, without an SSLRequest (see setDirectTls), as the stub allows
+//   --pg host:port    a real TLS Postgres instead of the stub (its cert must be for host, signed by
+//                     certdir/ca.pem); with --user, --password and --database
+//
+// Runs the built client end to end: each pgdir (a copy of pg/ from buildwolf.sh or buildbear.sh, as
+// made by run.sh) is loaded by Miniflare, and connects through a local WebSocket-to-TCP proxy (see
+// proxy.mjs) to a TLS Postgres stub (see pgstub.mjs) that presents a cert from gencert.sh. Reports
+// connect latency, query latency percentiles, bulk throughput and, from client.stats, ASYNCIFY
+// suspensions per MB received.
+
+import { copyFileSync, readFileSync } from 'node:fs';
+import path from 'node:path';
+import { fileURLToPath } from 'node:url';
+import { Miniflare } from 'miniflare';
+import { startProxy } from './proxy.mjs';
+import { startPgStub } from './pgstub.mjs';
+
+const options = { rtt: '0,20', connects: '10', queries: '200', 'bulk-mb': '16', mux: '', direct: '', pg: '', user: 'bench', password: 'bench', database: 'bench' };
+const dirs = [];
+for (let args = process.argv.slice(2); args.length > 0;) {
+  const arg = args.shift();
+  if (arg.startsWith('--')) options[arg.slice(2)] = args.shift();
+  else dirs.push(arg);
+}
+const [certDir, ...pgDirs] = dirs;
+if (pgDirs.length === 0) {
+  console.error('usage: node bench/e2e/bench.mjs [options] certdir pgdir...');
+  process.exit(1);
+}
+
+const here = path.dirname(fileURLToPath(import.meta.url));
+const caCert = readFileSync(path.join(certDir, 'ca.pem'), 'utf8');
+
+let stub = null;
+let dbHost = 'localhost', dbPort;
+if (options.pg) {
+  const [host, port = '5432'] = options.pg.split(':');
+  dbHost = host;
+  dbPort = Number(port);
+} else {
+  stub = await startPgStub({ key: readFileSync(path.join(certDir, 'server.key')), cert: readFileSync(path.join(certDir, 'server.pem')) });
+  dbPort = stub.port;
+}
+const proxy = await startProxy();
+
+function percentile(values, p) {
+  const sorted = [...values].sort((a, b) => a - b);
+  return sorted[Math.min(sorted.length - 1, Math.floor(p / 100 * sorted.length))];
+}
+
+const ms = x => x.toFixed(1).padStart(8);
+console.log('build           rtt  connect: cold   warm p50    query: p50      p90      p99    bulk MB/s  susp/MB');
+
+for (const rtt of options.rtt.split(',').map(Number)) {
+  proxy.rttMs = rtt;
+  for (const pgDir of pgDirs) {
+    copyFileSync(path.join(here, 'worker.mjs'), path.join(pgDir, 'bench-worker.mjs'));
+
+    // a fresh instance each time, so that the first connection pays for loading the module
+    const mf = new Miniflare({
+      scriptPath: path.join(pgDir, 'bench-worker.mjs'),
+      modules: true,
+      modulesRules: [{ type: 'CompiledWasm', include: ['**/*.wasm'], fallthrough: true }],
+      bindings: {
+        WS_PROXY: proxy.url,
+        MUX: options.mux,
+        DIRECT: options.direct,
+        DB_HOST: dbHost,
+        DB_PORT: String(dbPort),
+        DB_USER: options.user,
+        DB_PASSWORD: options.password,
+        DB_DATABASE: options.database,
+        CA_CERT: caCert,
+      },
+    });
+
+    const query = new URLSearchParams({ connects: options.connects, queries: options.queries, bulkBytes: String(Number(options['bulk-mb']) * 1048576) });
+    const response = await mf.dispatchFetch(`http://localhost/?${query}`);
+    if (!response.ok) throw new Error(`${pgDir}: ${response.status} ${await response.text()}`);
+    const { connectMs, queryMs, bulkBytes, bulkMs, stats } = await response.json();
+    await mf.dispose();
+
+    const [cold, ...warm] = connectMs;
+    const mbIn = stats.bytesIn / 1048576;
+    console.log(
+      (path.basename(pgDir) + (options.mux ? '+mux' : '') + (options.direct ? '+direct' : '')).padEnd(12), String(rtt).padStart(6),
+      ms(cold), '  ', ms(warm.length > 0 ? percentile(warm, 50) : NaN), '  ',
+      ms(percentile(queryMs, 50)), ms(percentile(queryMs, 90)), ms(percentile(queryMs, 99)),
+      (bulkBytes / 1048576 / (bulkMs / 1000)).toFixed(1).padStart(12),
+      (stats.suspensions / mbIn).toFixed(0).padStart(8),
+    );
+  }
+}
+
+await proxy.close();
+await stub?.close();
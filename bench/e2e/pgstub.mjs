@@ -0,0 +1,153 @@
+// A Postgres protocol stub, enough for the benchmark: SSLRequest (answered by TLS with the given
+// key and cert) or, unless direct is false, a ClientHello in its place, as PostgreSQL 17 allows
+// (see setDirectTls), trust authentication, and simple and extended queries, including portals executed
+// a batch of rows at a time. Every query returns one text column. A query containing
+// repeat('x', W) ... generate_series(1, N) returns N rows of W x's; anything else returns the row '1'.
+
+import net from 'node:net';
+import tls from 'node:tls';
+
+const SSL_REQUEST = 80877103;
+const MAX_STARTUP_PACKET_LENGTH = 10000;
+const TLS_HANDSHAKE = 0x16;  // the first byte of a ClientHello record
+
+function message(type, body = Buffer.alloc(0)) {
+  const msg = Buffer.alloc(5 + body.length);
+  msg.write(type, 0);
+  msg.writeInt32BE(body.length + 4, 1);
+  body.copy(msg, 5);
+  return msg;
+}
+
+const cstring = s => Buffer.from(s + '\0');
+const ready = message('Z', Buffer.from('I'));
+const rowDescription = message('T', Buffer.concat([
+  Buffer.from([0, 1]), cstring('v'),
+  Buffer.from([0, 0, 0, 0, 0, 0, 0, 0, 0, 25, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0, 0]),  // text, no typmod
+]));
+
+function dataRow(value) {
+  const v = Buffer.from(value);
+  const head = Buffer.alloc(6);
+  head.writeInt16BE(1);
+  head.writeInt32BE(v.length, 2);
+  return message('D', Buffer.concat([head, v]));
+}
+
+function resultFor(text) {
+  const m = text.match(/repeat\('x',\s*(\d+)\).*generate_series\(1,\s*(\d+)\)/is);
+  return m ? { row: dataRow('x'.repeat(Number(m[1]))), count: Number(m[2]) } : { row: dataRow('1'), count: 1 };
+}
+
+// rows [from, to) of a result, as a few large writes rather than one per row
+function writeRows(socket, result, from, to) {
+  const perWrite = Math.max(1, Math.floor(65536 / result.row.length));
+  for (let i = from; i < to; i += perWrite) {
+    socket.write(Buffer.concat(Array(Math.min(perWrite, to - i)).fill(result.row)));
+  }
+}
+
+function serve(socket, tlsOptions, direct) {
+  let buf = Buffer.alloc(0);
+  let started = false;
+  let portal = null;  // { result, next }
+  let skipToSync = false;
+
+  socket.on('data', data => {
+    buf = buf.length === 0 ? data : Buffer.concat([buf, data]);
+    for (;;) {
+      if (!started) {
+        if (buf[0] === TLS_HANDSHAKE && direct && tlsOptions !== undefined) return upgrade(socket, buf, tlsOptions, true);
+        if (buf.length < 8) return;
+        const len = buf.readInt32BE(0);
+        if (len < 8 || len > MAX_STARTUP_PACKET_LENGTH) return socket.destroy();  // as an older server does with a ClientHello
+        if (buf.length < len) return;
+        const code = buf.readInt32BE(4);
+        buf = buf.subarray(len);
+        if (code === SSL_REQUEST) return upgrade(socket, buf, tlsOptions);
+        started = true;
+        socket.write(Buffer.concat([
+          message('R', Buffer.alloc(4)),  // AuthenticationOk
+          message('S', Buffer.concat([cstring('server_version'), cstring('15.0')])),
+          message('K', Buffer.alloc(8)),
+          ready,
+        ]));
+        continue;
+      }
+
+      if (buf.length < 5) return;
+      const len = buf.readInt32BE(1);
+      if (buf.length < len + 1) return;
+      const type = String.fromCharCode(buf[0]);
+      const body = buf.subarray(5, len + 1);
+      buf = buf.subarray(len + 1);
+
+      if (type === 'X') return socket.end();
+      if (skipToSync && type !== 'S') continue;
+
+      switch (type) {
+        case 'Q': {
+          const result = resultFor(body.toString('utf8', 0, body.length - 1));
+          socket.write(rowDescription);
+          writeRows(socket, result, 0, result.count);
+          socket.write(Buffer.concat([message('C', cstring(`SELECT ${result.count}`)), ready]));
+          break;
+        }
+        case 'P':
+          portal = { result: resultFor(body.toString('utf8', 1, body.indexOf(0, 1))), next: 0 };
+          socket.write(message('1'));
+          break;
+        case 'B':
+          socket.write(message('2'));
+          break;
+        case 'D':
+          socket.write(rowDescription);
+          break;
+        case 'E': {
+          if (portal === null) {
+            skipToSync = true;
+            socket.write(message('E', Buffer.concat([cstring('SERROR'), cstring('C34000'), cstring('Mno portal'), Buffer.from([0])])));
+            break;
+          }
+          const limit = body.readInt32BE(1) || Infinity;
+          const to = Math.min(portal.result.count, portal.next + limit);
+          writeRows(socket, portal.result, portal.next, to);
+          portal.next = to;
+          socket.write(to < portal.result.count ? message('s') : message('C', cstring(`SELECT ${portal.result.count}`)));
+          break;
+        }
+        case 'S':
+          skipToSync = false;
+          portal = null;
+          socket.write(ready);
+          break;
+        case 'H':
+          break;
+      }
+    }
+  });
+  socket.on('error', () => { });
+}
+
+function upgrade(socket, rest, tlsOptions, direct = false) {
+  socket.removeAllListeners('data');
+  socket.pause();
+  if (rest.length > 0) socket.unshift(rest);  // e.g. a ClientHello sent without waiting
+  if (tlsOptions === undefined) {
+    socket.write('N');
+    serve(socket);
+    return socket.resume();
+  }
+  if (!direct) socket.write('S');
+  serve(new tls.TLSSocket(socket, { isServer: true, ALPNProtocols: ['postgresql'], ...tlsOptions }));
+}
+
+export async function startPgStub({ port = 0, key, cert, direct = true } = {}) {
+  const tlsOptions = key && cert ? { key, cert } : undefined;
+  const server = net.createServer(socket => {
+    socket.setNoDelay(true);
+    serve(socket, tlsOptions, direct);
+  });
+  await new Promise(resolve => server.listen(port, 'localhost', resolve));
+  return { port: server.address().port, close: () => new Promise(resolve => server.close(resolve)) };
+}
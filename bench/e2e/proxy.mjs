@@ -0,0 +1,163 @@
+// A local stand-in for the WebSocket-to-TCP proxy: the same protocol as the hosted one (a WebSocket
+// upgrade to /?name=host:port, then binary messages each way), with each direction delayed by half of
+// rttMs, to stand in for the distance between the Worker and the database. rttMs can be changed
+// between runs.
+//
+// It's also the reference implementation of the multiplexed protocol (see src/wsmux.ts): an upgrade
+// to /?mux=1 that asks for the wsmux.v1 subprotocol is answered with a HELLO frame, and then carries
+// any number of streams, each with its own TCP socket, which is paused while the client has no window
+// left for it.
+//
+// usage, stand-alone: node bench/e2e/proxy.mjs [port]  (then e.g. setWsProxy('http://localhost:9090/'))
+
+import net from 'node:net';
+import { pathToFileURL } from 'node:url';
+import { WebSocketServer } from 'ws';
+
+// see src/wsmux.ts
+const MUX_PROTOCOL = 'wsmux.v1';
+const MUX_OPEN = 0, MUX_DATA = 1, MUX_CLOSE = 2, MUX_WINDOW = 3, MUX_HELLO = 4;
+const MUX_WINDOW_SIZE = 262144;
+const HEADER_SIZE = 5;
+
+function frame(type, id, payload = Buffer.alloc(0)) {
+  const bytes = Buffer.allocUnsafe(HEADER_SIZE + payload.length);
+  bytes[0] = type;
+  bytes.writeUInt32BE(id, 1);
+  payload.copy(bytes, HEADER_SIZE);
+  return bytes;
+}
+
+export async function startProxy({ port = 0, rttMs = 0 } = {}) {
+  const wss = new WebSocketServer({
+    port,
+    handleProtocols: protocols => protocols.has(MUX_PROTOCOL) ? MUX_PROTOCOL : false,
+  });
+  const proxy = {
+    rttMs,
+    url: '',
+    stats: { sockets: 0, tunnels: 0, streams: 0 },
+    close() {
+      for (const ws of wss.clients) ws.terminate();
+      return new Promise(resolve => wss.close(resolve));
+    },
+  };
+
+  // timers with equal delays fire in the order they were set, so ordering is kept
+  const delayed = fn => proxy.rttMs > 0 ? setTimeout(fn, proxy.rttMs / 2) : fn();
+
+  function connect(name) {
+    const [host, tcpPort] = name.split(':');
+    const socket = net.connect(Number(tcpPort), host);  // writes are queued until it connects
+    socket.setNoDelay(true);
+    return socket;
+  }
+
+  function serveSingle(ws, name) {
+    proxy.stats.sockets++;
+    const socket = connect(name);
+    ws.on('message', data => delayed(() => socket.write(data)));
+    socket.on('data', data => delayed(() => ws.readyState === ws.OPEN && ws.send(data)));
+    ws.on('close', () => delayed(() => socket.end()));
+    socket.on('close', () => delayed(() => ws.close()));
+    ws.on('error', () => socket.destroy());
+    socket.on('error', () => ws.terminate());
+  }
+
+  function serveMux(ws) {
+    proxy.stats.tunnels++;
+    const streams = new Map();  // id -> { socket, sendWindow, pending, ended, unacknowledged }
+    const send = bytes => ws.readyState === ws.OPEN && ws.send(bytes);
+
+    function closeStream(id, reason = '') {
+      const stream = streams.get(id);
+      if (stream === undefined) return;
+      streams.delete(id);
+      stream.socket.destroy();
+      send(frame(MUX_CLOSE, id, Buffer.from(reason)));
+    }
+
+    function open(id, name) {
+      proxy.stats.streams++;
+      const stream = { socket: connect(name), sendWindow: MUX_WINDOW_SIZE, pending: [], ended: false, unacknowledged: 0 };
+      streams.set(id, stream);
+
+      stream.socket.on('data', data => {
+        stream.pending.push(data);
+        flush(id, stream);
+      });
+      stream.socket.on('close', () => {  // but not before what's still pending has been sent
+        stream.ended = true;
+        flush(id, stream);
+      });
+      stream.socket.on('error', err => delayed(() => closeStream(id, err.message)));
+    }
+
+    // sends what the client has room for, and stops reading the socket while anything's left over
+    function flush(id, stream) {
+      while (stream.pending.length > 0 && stream.sendWindow > 0) {
+        let data = stream.pending[0];
+        if (data.length > stream.sendWindow) {
+          stream.pending[0] = data.subarray(stream.sendWindow);
+          data = data.subarray(0, stream.sendWindow);
+        } else {
+          stream.pending.shift();
+        }
+        stream.sendWindow -= data.length;
+        const dataFrame = frame(MUX_DATA, id, data);
+        delayed(() => send(dataFrame));
+      }
+      if (stream.pending.length > 0) stream.socket.pause();
+      else if (stream.ended) delayed(() => closeStream(id));
+      else stream.socket.resume();
+    }
+
+    function received(bytes) {
+      if (bytes.length < HEADER_SIZE) return ws.terminate();
+      const type = bytes[0], id = bytes.readUInt32BE(1), payload = bytes.subarray(HEADER_SIZE);
+      const stream = streams.get(id);
+
+      if (type === MUX_OPEN) {
+        if (stream === undefined) open(id, payload.toString());
+      } else if (type === MUX_DATA && stream !== undefined) {
+        stream.socket.write(payload, () => {  // written, so the client may send that much more
+          stream.unacknowledged += payload.length;
+          if (stream.unacknowledged < MUX_WINDOW_SIZE / 2) return;
+          const window = Buffer.allocUnsafe(4);
+          window.writeUInt32BE(stream.unacknowledged);
+          stream.unacknowledged = 0;
+          delayed(() => send(frame(MUX_WINDOW, id, window)));
+        });
+      } else if (type === MUX_WINDOW && stream !== undefined) {
+        stream.sendWindow += payload.readUInt32BE(0);
+        flush(id, stream);
+      } else if (type === MUX_CLOSE && stream !== undefined) {
+        streams.delete(id);
+        stream.socket.end();
+      }
+    }
+
+    send(frame(MUX_HELLO, 0));
+    ws.on('message', data => delayed(() => received(data)));
+    ws.on('close', () => delayed(() => {
+      for (const { socket } of streams.values()) socket.destroy();
+      streams.clear();
+    }));
+    ws.on('error', () => ws.terminate());
+  }
+
+  wss.on('connection', (ws, req) => {
+    const params = new URL(req.url, 'http://localhost').searchParams;
+    if (ws.protocol === MUX_PROTOCOL) serveMux(ws);
+    else serveSingle(ws, params.get('name'));
+  });
+
+  await new Promise(resolve => wss.on('listening', resolve));
+  proxy.url = `http://localhost:${wss.address().port}/`;
+  return proxy;
+}
+
+if (import.meta.url === pathToFileURL(process.argv[1]).href) {
+  const proxy = await startProxy({ port: Number(process.argv[2] ?? 9090) });
+  console.log(`proxying on ${proxy.url}`);
+}
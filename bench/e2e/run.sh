@@ -0,0 +1,20 @@
+#!/usr/bin/env zsh -e
+
+# usage: bench/e2e/run.sh [nobuild] [bench.mjs options, e.g. --rtt 0,20,80]
+# Builds pg/ with each engine (unless nobuild), keeps a copy of each in build/e2e/pg-{wolf,bear},
+# and benchmarks both end to end under Miniflare (see bench.mjs); pg/ is left with the BearSSL build
+
+OUT=build/e2e
+[ -f $OUT/certs/ca.pem ] || bench/gencert.sh $OUT/certs
+
+if [ "$1" = "nobuild" ]; then
+  shift
+else
+  for engine in wolf bear; do
+    ./build$engine.sh
+    mkdir -p $OUT/pg-$engine
+    cp pg/postgres.js pg/tls.wasm $OUT/pg-$engine/
+  done
+fi
+
+node bench/e2e/bench.mjs $@ $OUT/certs $OUT/pg-wolf $OUT/pg-bear
@@ -0,0 +1,65 @@
+// The benchmark's Worker: bench.mjs copies it next to each build's postgres.js and tls.wasm, and runs
+// it under Miniflare. One request runs the whole suite, since a Worker's sockets can't outlive the
+// request that opened them, and returns the timings as JSON.
+
+import { Client, MuxTunnel, setDirectTls, setMuxTunnel, setWsProxy } from './postgres.js';
+
+const now = typeof performance !== 'undefined' ? () => performance.now() : () => Date.now();
+
+export default {
+  async fetch(request, env) {
+    const params = new URL(request.url).searchParams;
+    const connects = Number(params.get('connects'));
+    const queries = Number(params.get('queries'));
+    const bulkBytes = Number(params.get('bulkBytes'));
+    const rowBytes = 1000;
+
+    setWsProxy(env.WS_PROXY);
+    const mux = env.MUX ? new MuxTunnel(env.WS_PROXY) : null;  // per request: see MuxTunnel
+    setMuxTunnel(mux);
+    setDirectTls(Boolean(env.DIRECT));
+    const config = {
+      hostname: env.DB_HOST,  // must match the server's cert
+      port: Number(env.DB_PORT),
+      user: env.DB_USER,
+      password: env.DB_PASSWORD,
+      database: env.DB_DATABASE,
+      tls: { enabled: true, enforce: true, caCertificates: [env.CA_CERT] },
+    };
+
+    // the first includes instantiating the wasm module and a full handshake; later ones can resume
+    const connectMs = [];
+    for (let i = 0; i < connects; i++) {
+      const client = new Client(config);
+      const started = now();
+      await client.connect();
+      connectMs.push(now() - started);
+      await client.end();
+    }
+
+    const client = new Client(config);
+    await client.connect();
+
+    const queryMs = [];
+    for (let i = 0; i < queries; i++) {
+      const started = now();
+      await client.queryArray('SELECT 1');
+      queryMs.push(now() - started);
+    }
+
+    const rows = Math.ceil(bulkBytes / rowBytes);
+    let bytes = 0;
+    const bulkStarted = now();
+    const stream = await client.queryArrayStream(`SELECT repeat('x', ${rowBytes}) FROM generate_series(1, ${rows})`, 1000);
+    for await (const [value] of stream) bytes += value.length;
+    const bulkMs = now() - bulkStarted;
+
+    const stats = client.stats;
+    await client.end();
+    mux?.close();
+
+    return new Response(JSON.stringify({ connectMs, queryMs, bulkBytes: bytes, bulkMs, stats }), {
+      headers: { 'Content-Type': 'application/json' },
+    });
+  },
+};
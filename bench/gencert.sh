@@ -0,0 +1,20 @@
+#!/usr/bin/env zsh -e
+
+# usage: bench/gencert.sh outdir
+# Makes a throwaway ECDSA P-256 root (ca.pem) and a server cert for localhost signed by it
+# (server.pem, with the chain, plus server.key), for the loopback benchmark
+
+OUT=$1
+mkdir -p $OUT
+cd $OUT
+
+openssl ecparam -name prime256v1 -genkey -noout -out ca.key
+openssl req -x509 -new -key ca.key -sha256 -days 3650 -subj "/CN=wstls bench root" \
+  -addext "basicConstraints=critical,CA:TRUE" -addext "keyUsage=critical,keyCertSign" -out ca.pem
+
+openssl ecparam -name prime256v1 -genkey -noout -out server.key
+openssl req -new -key server.key -subj "/CN=localhost" -out server.csr
+openssl x509 -req -in server.csr -CA ca.pem -CAkey ca.key -CAcreateserial -sha256 -days 3650 \
+  -extfile <(printf "subjectAltName=DNS:localhost\nbasicConstraints=CA:FALSE\n") -out server.crt
+cat server.crt ca.pem > server.pem
+rm server.csr server.crt ca.srl
@@ -1,22 +1,75 @@
 #!/usr/bin/env zsh -e
 
-if [ "$1" != "quick" ]; then
+# usage: [ROOTS=bundle.pem ...] ./buildbear.sh [quick] [nonblocking] [simd] [lean] [static] [subtle]
+
+EXPORTS=_tlsOpen,_tlsConnect,_writeData,_readData,_readDataInPlace,_readDataPointer,_hasPending,_tlsShutdown,_tlsClose,_tlsSetSession,_tlsGetSession,_tlsSessionReused,_tlsSetAlpn,_tlsAlpnSelected,_tlsStats,_tlsCipherSuite,_tlsProtocolVersion,_malloc,_free
+MEMFLAGS=(-sALLOW_MEMORY_GROWTH=1)
+MODEFLAGS=(-sASYNCIFY=1)
+
+OPTFLAGS=(-Oz)  # the default profile is optimized for size
+if (( ${@[(I)simd]} )); then
+  # the speed profile: wasm SIMD (which Workers support), with BearSSL's SIMD ChaCha20 (see src/chacha20_simd.c)
+  OPTFLAGS=(-O3 -msimd128)
+fi
+
+if (( ${@[(I)nonblocking]} )); then
+  # no ASYNCIFY: see the non-blocking API in src/bearssl.c
+  EXPORTS=$EXPORTS,_encryptedInputBuffer,_feedEncrypted,_pendingEncrypted,_encryptedOutputBuffer,_takeEncrypted
+  MODEFLAGS=(-DNONBLOCKING)
+else
+  EXPORTS=$EXPORTS,_tlsSetNonBlocking  # so that JS can wait for the network outside the module
+fi
+
+if (( ${@[(I)subtle]} )); then
+  # AES-GCM records of 1KB and up (by default: see tlsCalibrate) go to WebCrypto, via BearSSL's
+  # record-layer vtables (see USESUBTLECB in src/bearssl.c); needs ASYNCIFY, so not with nonblocking
+  MODEFLAGS+=(-DUSESUBTLECB)
+  EXPORTS=$EXPORTS,_tlsCalibrate,_tlsCryptoPolicy
+fi
+
+if (( ${@[(I)lean]} )); then
+  # less memory per connection, and per isolate: engine buffers for 4KB records (see
+  # src/bearssl.c), and a 64KB stack, of which BearSSL needs only a fraction
+  MODEFLAGS+=(-DLEAN_MEMORY -sTOTAL_STACK=65536)
+  MEMFLAGS+=(-sINITIAL_MEMORY=2097152)
+fi
+
+if (( ${@[(I)static]} )); then
+  # fixed memory, allocated once: the shim's arenas are sized for STATIC_CONNECTIONS connections (see
+  # src/bearssl.c), and the heap never grows, so views of it never go stale; not for the non-blocking build
+  MODEFLAGS+=(-DSTATIC_MEMORY -DMAX_CONNECTIONS=${STATIC_CONNECTIONS:-8} -sTOTAL_STACK=65536)
+  MEMFLAGS=(-sALLOW_MEMORY_GROWTH=0 -sINITIAL_MEMORY=${STATIC_HEAP:-$(( ${@[(I)lean]} ? 2097152 : 4194304 ))})
+fi
+
+if (( ! ${@[(I)quick]} )); then
+  echo "Generating trust anchors ..."
+  node gentrust.mjs ${=ROOTS}  # e.g. ROOTS="certs/roots.pem certs/private-ca.pem"; default: certs/roots.pem
+
   echo "Compiling BearSSL to WASM ..."
-  emcc src/bearssl.c $(find ../BearSSL/src -name \*.c) \
+  emcc src/bearssl.c src/platform_emscripten.c src/chacha20_simd.c $(find ../BearSSL/src -name \*.c) \
     -I../BearSSL/inc -I../BearSSL/src \
     -o build/tls.js \
-    -sEXPORTED_FUNCTIONS=_initTls,_writeData,_readData,_malloc,_free \
+    -sEXPORTED_FUNCTIONS=$EXPORTS \
     -sEXPORTED_RUNTIME_METHODS=ccall,cwrap \
-    -sASYNCIFY=1 -sDYNAMIC_EXECUTION=0 -sALLOW_MEMORY_GROWTH=1 \
+    -sDYNAMIC_EXECUTION=0 $MEMFLAGS \
     -sNO_FILESYSTEM=1 -sENVIRONMENT=web \
     -sMODULARIZE=1 -sEXPORT_NAME=tls_emscripten -flto \
-    -Oz # -DCHATTY
+    $OPTFLAGS $MODEFLAGS # -DCHATTY
 
   echo "Fixing up exports ..."
   sed \
     -e '2s/^var /export const /' \
     -e "/if (typeof exports === 'object' && typeof module === 'object')/,\$d" \
     -I '' build/tls.js
+
+  # kept side by side, for comparison between profiles
+  PROFILE=$( (( ${@[(I)simd]} )) && echo simd || echo size )
+  (( ${@[(I)lean]} )) && PROFILE=$PROFILE-lean
+  (( ${@[(I)static]} )) && PROFILE=$PROFILE-static
+  (( ${@[(I)subtle]} )) && PROFILE=$PROFILE-subtle
+  cp build/tls.wasm build/tls-bear-$PROFILE.wasm
+  echo "Sizes:"
+  ls -l build/tls-*.wasm
 fi
 
 echo "Building pg library ..."
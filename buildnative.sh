@@ -0,0 +1,35 @@
+#!/usr/bin/env zsh -e
+
+# usage: ./buildnative.sh [bench]
+# Builds the TLS shims natively (not to wasm), against system WolfSSL and BearSSL, plus a loopback
+# benchmark for each engine and mode (see bench/bench.c), so that the C side can be profiled with
+# perf etc.; the WebCrypto callbacks (USESUBTLECB) exist only in the wasm build
+
+OUT=build/native
+WRAP=-Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc,--wrap=free  # for allocation counting
+mkdir -p $OUT
+
+[ -f $OUT/certs/ca.pem ] || bench/gencert.sh $OUT/certs
+
+for engine in wolfssl bearssl; do
+  for mode in blocking nonblocking lean static; do
+    [ $mode = static ] && [ $engine = wolfssl ] && continue  # needs a system WolfSSL configured with --enable-staticmemory
+    FLAGS=()
+    LIBS=(-lwolfssl -lpthread)  # WolfSSL is always needed, for the benchmark's server
+    [ $mode = nonblocking ] && FLAGS+=(-DNONBLOCKING)
+    [ $mode = lean ] && FLAGS+=(-DLEAN_MEMORY)  # blocking, with 4KB records: the server needs --enable-maxfragment
+    [ $mode = static ] && FLAGS+=(-DSTATIC_MEMORY -DMAX_CONNECTIONS=8)  # blocking, with the shim's arenas (see src/arena.h)
+    [ $engine = bearssl ] && FLAGS+=(-DBENCH_BEARSSL) && LIBS+=(-lbearssl)
+
+    echo "Compiling $engine ($mode) ..."
+    cc src/$engine.c src/platform_native.c bench/bench.c \
+      -Isrc -o $OUT/bench-$engine-$mode \
+      -O2 -g $FLAGS $LIBS $WRAP # -DCHATTY
+  done
+done
+
+if [ "$1" = "bench" ]; then
+  for bench in $OUT/bench-*; do $bench $OUT/certs; done
+fi
+
+echo "Done."
@@ -1,23 +1,70 @@
 #!/usr/bin/env zsh -e
 
-if [ "$1" != "quick" ]; then
+# usage: [ROOTS=bundle.pem ...] ./buildwolf.sh [quick] [nonblocking] [simd] [lean] [static]
+
+EXPORTS=_tlsOpen,_tlsConnect,_writeData,_readData,_readDataInPlace,_readDataPointer,_pending,_hasPending,_tlsShutdown,_tlsClose,_tlsSetSession,_tlsGetSession,_tlsSessionReused,_tlsSetAlpn,_tlsAlpnSelected,_tlsStats,_tlsCipherSuite,_tlsProtocolVersion,_malloc,_free
+MEMFLAGS=(-sALLOW_MEMORY_GROWTH=1)
+MODEFLAGS=(-sASYNCIFY=1 -DUSESUBTLECB)
+
+OPTFLAGS=(-Oz)  # the default profile is optimized for size
+if (( ${@[(I)simd]} )); then
+  # the speed profile: -O3, with wasm SIMD (which Workers support) for the compiler to auto-vectorize with;
+  # WolfSSL has no wasm SIMD code of its own, so rebuild it to match with ./buildwolflib.sh simd
+  OPTFLAGS=(-O3 -msimd128)
+fi
+
+if (( ${@[(I)nonblocking]} )); then
+  # no ASYNCIFY, so no async crypto callbacks either: see the non-blocking API in src/wolfssl.c
+  EXPORTS=$EXPORTS,_encryptedInputBuffer,_feedEncrypted,_pendingEncrypted,_encryptedOutputBuffer,_takeEncrypted
+  MODEFLAGS=(-DNONBLOCKING)
+else
+  EXPORTS=$EXPORTS,_tlsSetNonBlocking,_tlsCalibrate,_tlsCryptoPolicy  # the WebCrypto offload policy: see CryptoPolicy in src/wolfssl.c
+fi
+
+if (( ${@[(I)lean]} )); then
+  # less memory per connection, and per isolate: 4KB records (see src/wolfssl.c), and a 64KB stack,
+  # which WolfSSL only keeps within when built with --enable-smallstack (see buildwolflib.sh lean)
+  MODEFLAGS+=(-DLEAN_MEMORY -sTOTAL_STACK=65536)
+  MEMFLAGS+=(-sINITIAL_MEMORY=2097152)
+fi
+
+if (( ${@[(I)static]} )); then
+  # fixed memory, allocated once: WolfSSL's static pools and the shim's arenas are sized for
+  # STATIC_CONNECTIONS connections (see src/wolfssl.c), and the heap never grows, so views of it
+  # never go stale; needs ./buildwolflib.sh static, and isn't for the non-blocking build
+  MODEFLAGS+=(-DSTATIC_MEMORY -DMAX_CONNECTIONS=${STATIC_CONNECTIONS:-8})
+  MEMFLAGS=(-sALLOW_MEMORY_GROWTH=0 -sINITIAL_MEMORY=${STATIC_HEAP:-$(( ${@[(I)lean]} ? 4194304 : 16777216 ))})
+fi
+
+if (( ! ${@[(I)quick]} )); then
+  echo "Generating trust anchors ..."
+  node gentrust.mjs ${=ROOTS}  # e.g. ROOTS="certs/roots.pem certs/private-ca.pem"; default: certs/roots.pem
+
   echo "Compiling WolfSSL to WASM ..."
-    emcc src/wolfssl.c \
+    emcc src/wolfssl.c src/platform_emscripten.c \
       ../wolfssl-5.5.1-stable/wolfcrypt/src/*.o ../wolfssl-5.5.1-stable/src/*.o \
       -I../wolfssl-5.5.1-stable/ \
       -o build/tls.js \
-      -sEXPORTED_FUNCTIONS=_initTls,_writeData,_readData,_pending,_shutdown,_malloc,_free \
+      -sEXPORTED_FUNCTIONS=$EXPORTS \
       -sEXPORTED_RUNTIME_METHODS=ccall,cwrap \
-      -sASYNCIFY=1 -sALLOW_MEMORY_GROWTH=1 -sDYNAMIC_EXECUTION=0 \
+      $MEMFLAGS -sDYNAMIC_EXECUTION=0 \
       -sNO_FILESYSTEM=1 -sENVIRONMENT=web \
       -sMODULARIZE=1 -sEXPORT_NAME=tls_emscripten \
-      -Oz -flto -DUSESUBTLECB # -DCHATTY
+      $OPTFLAGS -flto $MODEFLAGS # -DCHATTY
 
   echo "Fixing up exports ..."
   sed \
     -e '2s/^var /export const /' \
     -e "/if (typeof exports === 'object' && typeof module === 'object')/,\$d" \
     -I '' build/tls.js
+
+  # kept side by side, for comparison between profiles
+  PROFILE=$( (( ${@[(I)simd]} )) && echo simd || echo size )
+  (( ${@[(I)lean]} )) && PROFILE=$PROFILE-lean
+  (( ${@[(I)static]} )) && PROFILE=$PROFILE-static
+  cp build/tls.wasm build/tls-wolf-$PROFILE.wasm
+  echo "Sizes:"
+  ls -l build/tls-*.wasm
 fi
 
 echo "Building pg library ..."
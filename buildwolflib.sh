@@ -1,5 +1,16 @@
 #!/usr/bin/env zsh -e
 
+# usage: ./buildwolflib.sh [simd] [lean] [static]
+# (simd: build for speed, with wasm SIMD auto-vectorization, to go with ./buildwolf.sh simd;
+# lean: big temporaries on the heap rather than the stack, to go with ./buildwolf.sh lean;
+# static: allocations from fixed pools given to the context, to go with ./buildwolf.sh static)
+
+OPT="-Oz"
+(( ${@[(I)simd]} )) && OPT="-O3 -msimd128"
+EXTRA=()
+(( ${@[(I)lean]} )) && EXTRA+=(--enable-smallstack)
+(( ${@[(I)static]} )) && EXTRA+=(--enable-staticmemory)
+
 cd ../wolfssl-5.5.1-stable
 
 echo "Patching wolfscript/src/random.c to use crypto.getRandomBytes() ..."
@@ -22,11 +33,12 @@ echo "Configuring ..."
 emconfigure ./configure \
   --disable-filesystem --disable-examples \
   --disable-oldtls --disable-tlsv12 \
-  --enable-tls13 --enable-maxstrength --enable-sni --enable-altcertchains  \
+  --enable-tls13 --enable-maxstrength --enable-sni --enable-alpn --enable-altcertchains --enable-session-ticket \
+  --enable-curve25519 --enable-sp --enable-maxfragment $EXTRA \
   --disable-asm --enable-fastmath --enable-static --disable-shared \
   CFLAGS="-DWOLFSSL_USER_IO -DSINGLETHREADED -DWOLFSSL_TLS13_MIDDLEBOX_COMPAT -DWOLFSSL_NO_ASYNC_IO -DNO_PSK \
-    -DNO_WRITEV -DNO_WOLFSSL_SERVER -DNO_ERROR_STRINGS -DNO_DEV_RANDOM -DNO_DEV_URANDOM \
-    -Oz -I../emsdk/upstream/emscripten/cache/sysroot/include -flto" --enable-cryptocb
+    -DNO_WRITEV -DNO_WOLFSSL_SERVER -DNO_ERROR_STRINGS -DNO_DEV_RANDOM -DNO_DEV_URANDOM -DHAVE_EXT_CACHE \
+    $OPT -I../emsdk/upstream/emscripten/cache/sysroot/include -flto" --enable-cryptocb
 
 echo "Building ..."
 emmake make 
@@ -7,6 +7,276 @@ import generateBundlerConfig from "cloudflare-workers-compat/bundler-config";
 const __filename = fileURLToPath(import.meta.url);
 const __dirname = path.dirname(__filename);
 
+// Connection.pipeline: writes each query's Parse/Bind/Describe/Execute/Sync back to back, with one
+// flush, and then reads the results in order. Each query gets its own Sync, so each runs in its own
+// implicit transaction: one failing doesn't stop the rest, and all the results are read (keeping the
+// connection in step) before the first error is thrown.
+const connectionPipeline = `
+  async pipeline(queries) {
+    if (!this.connected) {
+      await this.startup(true);
+    }
+    await this.#queryLock.pop();
+    try {
+      for (const query of queries) {
+        await this.#appendQueryToMessage(query);
+        await this.#appendArgumentsToMessage(query);
+        await this.#appendDescribeToMessage();
+        await this.#appendExecuteToMessage();
+        await this.#appendSyncToMessage();
+      }
+      await this.#bufWriter.flush();
+
+      const results = [];
+      let error;
+      for (const query of queries) {
+        const result = query.result_type === ResultType.ARRAY ? new QueryArrayResult(query) : new QueryObjectResult(query);
+        let message = await this.#readMessage();
+        while (message.type !== INCOMING_QUERY_MESSAGES.READY) {
+          switch (message.type) {
+            case ERROR_MESSAGE:
+              error ??= new PostgresError(parseNoticeMessage(message));
+              break;
+            case INCOMING_QUERY_MESSAGES.COMMAND_COMPLETE:
+              result.handleCommandComplete(parseCommandCompleteMessage(message));
+              break;
+            case INCOMING_QUERY_MESSAGES.DATA_ROW:
+              try {
+                result.insertRow(parseRowDataMessage(message));
+              } catch (e) {
+                error ??= e;
+              }
+              break;
+            case INCOMING_QUERY_MESSAGES.NOTICE_WARNING: {
+              const notice = parseNoticeMessage(message);
+              logNotice(notice);
+              result.warnings.push(notice);
+              break;
+            }
+            case INCOMING_QUERY_MESSAGES.ROW_DESCRIPTION:
+              result.loadColumnDescriptions(parseRowDescriptionMessage(message));
+              break;
+            case INCOMING_QUERY_MESSAGES.BIND_COMPLETE:
+            case INCOMING_QUERY_MESSAGES.NO_DATA:
+            case INCOMING_QUERY_MESSAGES.PARAMETER_STATUS:
+            case INCOMING_QUERY_MESSAGES.PARSE_COMPLETE:
+              break;
+            default:
+              throw new Error(\`Unexpected pipelined query message: \${message.type}\`);
+          }
+          message = await this.#readMessage();
+        }
+        results.push(result);
+      }
+      if (error) throw error;
+      return results;
+    } catch (e) {
+      if (e instanceof ConnectionError) {
+        await this.end();
+      }
+      throw e;
+    } finally {
+      this.#queryLock.push(void 0);
+    }
+  }`;
+
+// Connection.streamRows and copyOut: return a ReadableStream that holds the query lock until it's
+// read to the end or cancelled, and reads from the connection only when its consumer pulls. Rows
+// come from the unnamed portal batchRows at a time (Execute with a row limit, then Flush), so the
+// server itself holds back the rest. COPY TO STDOUT can't be throttled that way: CopyData is read
+// and decrypted only on demand, but the server sends it as fast as the tunnel takes it.
+const connectionStreams = `
+  async #executeBatch(rows) {
+    this.#packetWriter.clear();
+    await this.#bufWriter.write(this.#packetWriter.addCString("").addInt32(rows).flush(69));
+    this.#packetWriter.clear();
+    await this.#bufWriter.write(this.#packetWriter.flush(72));
+    await this.#bufWriter.flush();
+  }
+  async #sendSync() {
+    await this.#appendSyncToMessage();
+    await this.#bufWriter.flush();
+  }
+  async #openStream(send, onMessage) {
+    if (!this.connected) {
+      await this.startup(true);
+    }
+    await this.#queryLock.pop();
+    let done = false;
+    const finish = () => {
+      if (!done) this.#queryLock.push(void 0);
+      done = true;
+    };
+    try {
+      await send();
+    } catch (e) {
+      finish();
+      if (e instanceof ConnectionError) await this.end();
+      throw e;
+    }
+    let error;
+    let cancelled = false;
+    let pulling = Promise.resolve();
+    // controller is null once the stream has been cancelled: what's left is read and dropped, so
+    // that the connection is ready for the next query
+    const read = async (controller) => {
+      try {
+        for (;;) {
+          const message = await this.#readMessage();
+          if (message.type === INCOMING_QUERY_MESSAGES.READY) {
+            finish();
+            if (cancelled) return;
+            if (error) controller.error(error);
+            else controller.close();
+            return;
+          }
+          if (message.type === ERROR_MESSAGE) {
+            error ??= new PostgresError(parseNoticeMessage(message));
+          } else if (message.type === INCOMING_QUERY_MESSAGES.NOTICE_WARNING) {
+            logNotice(parseNoticeMessage(message));
+            continue;
+          }
+          if (await onMessage(message, cancelled ? null : controller)) return;
+        }
+      } catch (e) {
+        if (!cancelled && !(e instanceof ConnectionError)) {
+          // e.g. a row that couldn't be decoded: the stream fails, but the connection can carry on
+          cancelled = true;
+          await read(null).catch(() => { });
+          controller.error(e);
+          return;
+        }
+        finish();
+        if (e instanceof ConnectionError) await this.end();
+        if (cancelled) throw e;
+        controller.error(e);
+      }
+    };
+    return new ReadableStream({
+      pull: (controller) => pulling = read(controller),
+      cancel: async () => {
+        cancelled = true;
+        await pulling;
+        if (!done) await read(null);
+      }
+    }, { highWaterMark: 0 });
+  }
+  streamRows(query, batchRows = 500) {
+    const result = query.result_type === ResultType.ARRAY ? new QueryArrayResult(query) : new QueryObjectResult(query);
+    let synced = false;
+    const sync = async () => {
+      if (!synced) await this.#sendSync();
+      synced = true;
+    };
+    return this.#openStream(async () => {
+      await this.#appendQueryToMessage(query);
+      await this.#appendArgumentsToMessage(query);
+      await this.#appendDescribeToMessage();
+      await this.#executeBatch(batchRows);
+    }, async (message, controller) => {
+      switch (message.type) {
+        case INCOMING_QUERY_MESSAGES.DATA_ROW:
+          if (controller === null) return false;
+          result.insertRow(parseRowDataMessage(message));
+          controller.enqueue(result.rows.pop());
+          return true;
+        case "s":
+          if (controller === null) await sync();
+          else await this.#executeBatch(batchRows);
+          return false;
+        case INCOMING_QUERY_MESSAGES.ROW_DESCRIPTION:
+          result.loadColumnDescriptions(parseRowDescriptionMessage(message));
+          return false;
+        case ERROR_MESSAGE:
+        case INCOMING_QUERY_MESSAGES.COMMAND_COMPLETE:
+          await sync();
+          return false;
+        case INCOMING_QUERY_MESSAGES.BIND_COMPLETE:
+        case INCOMING_QUERY_MESSAGES.NO_DATA:
+        case INCOMING_QUERY_MESSAGES.PARAMETER_STATUS:
+        case INCOMING_QUERY_MESSAGES.PARSE_COMPLETE:
+          return false;
+        default:
+          throw new Error(\`Unexpected streamed query message: \${message.type}\`);
+      }
+    });
+  }
+  copyOut(text, chunkBytes = 65536) {
+    return this.#openStream(async () => {
+      this.#packetWriter.clear();
+      await this.#bufWriter.write(this.#packetWriter.addCString(text).flush(81));
+      await this.#bufWriter.flush();
+    }, async (message, controller) => {
+      switch (message.type) {
+        case "d": {
+          if (controller === null) return false;
+          // join whatever CopyData (typically a row each) is already buffered, without waiting on the network
+          const chunks = [message.body];
+          let length = message.body.length;
+          while (length < chunkBytes && this.#bufReader.buffered() >= 5) {
+            const header = await this.#bufReader.peek(5);
+            if (header[0] !== 100 || this.#bufReader.buffered() < 1 + readUInt32BE(header, 1)) break;
+            const next = await this.#readMessage();
+            chunks.push(next.body);
+            length += next.body.length;
+          }
+          let chunk = chunks[0];
+          if (chunks.length > 1) {
+            chunk = new Uint8Array(length);
+            let offset = 0;
+            for (const next of chunks) {
+              chunk.set(next, offset);
+              offset += next.length;
+            }
+          }
+          controller.enqueue(chunk);
+          return true;
+        }
+        case "H":
+        case "c":
+        case ERROR_MESSAGE:
+        case INCOMING_QUERY_MESSAGES.COMMAND_COMPLETE:
+        case INCOMING_QUERY_MESSAGES.PARAMETER_STATUS:
+          return false;
+        default:
+          throw new Error(\`Unexpected COPY message: \${message.type}\`);
+      }
+    });
+  }`;
+
+// QueryClient.queryArrayPipeline, queryObjectPipeline, queryArrayStream, queryObjectStream and
+// copyOutStream: each query is a string or a { text, args, ... } config, as for queryArray and
+// queryObject
+const queryClientPipeline = `
+  #assertQueryable() {
+    this.#assertOpenConnection();
+    if (this.#transaction !== null) {
+      throw new Error(\`This connection is currently locked by the "\${this.#transaction}" transaction\`);
+    }
+  }
+  async #pipeline(queries, result_type) {
+    this.#assertQueryable();
+    return await this.#connection.pipeline(queries.map((query) => new Query(query, result_type)));
+  }
+  queryArrayPipeline(queries) {
+    return this.#pipeline(queries, ResultType.ARRAY);
+  }
+  queryObjectPipeline(queries) {
+    return this.#pipeline(queries, ResultType.OBJECT);
+  }
+  async queryArrayStream(query, batchRows) {
+    this.#assertQueryable();
+    return await this.#connection.streamRows(new Query(query, ResultType.ARRAY), batchRows);
+  }
+  async queryObjectStream(query, batchRows) {
+    this.#assertQueryable();
+    return await this.#connection.streamRows(new Query(query, ResultType.OBJECT), batchRows);
+  }
+  async copyOutStream(text, chunkBytes) {
+    this.#assertQueryable();
+    return await this.#connection.copyOut(text, chunkBytes);
+  }`;
+
 /** @type {import("esbuild").BuildOptions} */
 const common = {
   bundle: true,
@@ -27,7 +297,12 @@ const compatConfig = await generateBundlerConfig({
 
 await build({
   ...common,
-  entryPoints: [path.join(__dirname, "build", "postgres-deno.js")],
+  // the deno bundle is just the upstream driver, so add our own exports (see mod.ts) to it
+  stdin: {
+    contents: 'export * from "./build/postgres-deno.js";\nexport { KeepAlivePool } from "./pool.ts";\nexport { setWsProxy, setMuxTunnel, setDirectTls } from "./tunnel.ts";\nexport { MuxTunnel } from "../src/wsmux.ts";\n',
+    resolveDir: __dirname,
+    sourcefile: "entry.js"
+  },
   outfile: path.join(__dirname, "build", "postgres-tmp.js"),
   plugins: [
     replace({
@@ -68,7 +343,10 @@ await build({
         "var data = decode(\"": "var data = null && decode(\"",
         "var wasm =": "var wasm = null &&",
         "var wasmInstance =": "var wasmInstance = null &&",
-        "var wasmModule =": "var wasmModule = null &&"
+        "var wasmModule =": "var wasmModule = null &&",
+        // Expose TcpOverWebsocketConn.getStats() as client.stats
+        "var Connection = class {": "var Connection = class {\n  get stats() {\n    return this.#conn?.getStats?.();\n  }" + connectionPipeline + connectionStreams,
+        "var QueryClient = class {": "var QueryClient = class {\n  get stats() {\n    return this.#connection.stats;\n  }" + queryClientPipeline
       }
     })
   ],
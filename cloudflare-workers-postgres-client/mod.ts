@@ -1,2 +1,6 @@
 export { Client } from "https://deno.land/x/postgres@v0.16.1/mod.ts";
 export { Deferred as __Deferred } from "https://deno.land/x/deferred@v1.0.1/mod.ts";
+export { KeepAlivePool } from "./pool.ts";
+export type { KeepAlivePoolOptions } from "./pool.ts";
+export { setWsProxy, setMuxTunnel, setDirectTls } from "./tunnel.ts";
+export { MuxTunnel } from "../src/wsmux.ts";
@@ -0,0 +1,207 @@
+import { Client } from "https://deno.land/x/postgres@v0.16.1/mod.ts";
+
+export interface KeepAlivePoolOptions {
+  /** Clients open at once, busy or idle. Default 4. */
+  max?: number;
+  /** Idle clients older than this are closed rather than reused. Default 30s. */
+  idleTimeoutMs?: number;
+  /** A client idle for longer than this is checked with `SELECT 1` before it's reused. Default 5s. */
+  checkAfterIdleMs?: number;
+  /** Reuse clients across scopes (see KeepAlivePool). Default false. */
+  shareAcrossRequests?: boolean;
+}
+
+interface PoolEntry {
+  client: Client;
+  scope: unknown;  // whoever opened the client: only they may do I/O on it, unless shareAcrossRequests
+  idleSince: number;
+  closeOnRelease: boolean;
+}
+
+interface Waiter {
+  scope: unknown;
+  resolve: (entry: PoolEntry | null) => void;  // null: try again
+}
+
+/**
+ * A keep-alive pool of connected, authenticated Postgres clients, meant to live at isolate scope
+ * (in a module-level variable), so that a warm request can go straight to its query. The wasm TLS
+ * module is shared by the isolate regardless, so the saving here is the WebSocket upgrade, the TLS
+ * handshake and the Postgres startup and authentication.
+ *
+ * Cloudflare Workers don't let a request do I/O on a socket opened by another request. So, by
+ * default, a client is only reused by the scope that opened it: pass connect() something unique to
+ * the request, such as its ExecutionContext, and pass the same thing to endScope() once the request
+ * is done (e.g. via ctx.waitUntil). Where sockets may be shared between requests -- in a Durable
+ * Object, or under Node -- set shareAcrossRequests, and connections stay warm from one request to
+ * the next.
+ *
+ * A client handed out by connect() must be handed back via release(). Concurrent connect() calls
+ * beyond `max` wait for a release, in order.
+ */
+export class KeepAlivePool {
+  #createClient: () => Client;
+  #max: number;
+  #idleTimeoutMs: number;
+  #checkAfterIdleMs: number;
+  #shareAcrossRequests: boolean;
+
+  #idle: PoolEntry[] = [];  // least recently released first
+  #busy = new Map<Client, PoolEntry>();
+  #opening = 0;
+  #waiters: Waiter[] = [];
+  #ended = false;
+
+  stats = { opened: 0, reused: 0, failedChecks: 0, expired: 0, waited: 0 };
+
+  constructor(createClient: () => Client, options: KeepAlivePoolOptions = {}) {
+    this.#createClient = createClient;
+    this.#max = options.max ?? 4;
+    this.#idleTimeoutMs = options.idleTimeoutMs ?? 30_000;
+    this.#checkAfterIdleMs = options.checkAfterIdleMs ?? 5_000;
+    this.#shareAcrossRequests = options.shareAcrossRequests ?? false;
+  }
+
+  get size() {
+    return this.#idle.length + this.#busy.size + this.#opening;
+  }
+
+  get available() {
+    return this.#idle.length;
+  }
+
+  /** Resolves to a connected client, reusing an idle one if possible. */
+  async connect(scope: unknown = this): Promise<Client> {
+    for (;;) {
+      if (this.#ended) throw new Error("Pool has ended");
+      this.#expire(scope);
+
+      let entry: PoolEntry | null;
+      while ((entry = this.#takeIdle(scope)) !== null) {
+        this.#busy.set(entry.client, entry);  // still counted while it's checked
+        if (await this.#isAlive(entry)) return this.#handOut(entry, scope);
+        this.#busy.delete(entry.client);
+        this.stats.failedChecks++;
+        this.#close(entry, scope);
+      }
+
+      // make room, if need be, by forgetting a client that this scope can't use anyway
+      if (this.size >= this.#max && this.#idle.length > 0) this.#close(this.#idle.shift()!, scope);
+      if (this.size < this.#max) return this.#open(scope);
+
+      this.stats.waited++;
+      entry = await new Promise<PoolEntry | null>(resolve => this.#waiters.push({ scope, resolve }));
+      if (entry !== null) return this.#handOut(entry, scope);
+    }
+  }
+
+  /** Returns a client to the pool. Pass discard = true if it may be in a bad state, e.g. after an error. */
+  release(client: Client, discard = false) {
+    const entry = this.#busy.get(client);
+    if (entry === undefined) return;
+    this.#busy.delete(client);
+
+    if (discard || entry.closeOnRelease || this.#ended || !client.connected) {
+      this.#close(entry, entry.scope);
+      this.#wakeWaiter();
+      return;
+    }
+
+    entry.idleSince = Date.now();
+    const i = this.#waiters.findIndex(waiter => this.#usableBy(entry, waiter.scope));
+    if (i >= 0) {
+      // straight to the next waiter that can use it: it was in use a moment ago, so no check
+      const [waiter] = this.#waiters.splice(i, 1);
+      this.#busy.set(client, entry);
+      waiter.resolve(entry);
+      return;
+    }
+
+    this.#idle.push(entry);
+    this.#wakeWaiter();  // a waiter from another scope may now make room for itself
+  }
+
+  /** Closes the scope's idle clients, and its busy ones once they're released. */
+  async endScope(scope: unknown) {
+    if (this.#shareAcrossRequests) return;
+    for (const entry of this.#busy.values()) if (entry.scope === scope) entry.closeOnRelease = true;
+    const ending = this.#idle.filter(entry => entry.scope === scope);
+    this.#idle = this.#idle.filter(entry => entry.scope !== scope);
+    await Promise.all(ending.map(entry => entry.client.end().catch(() => { })));
+    this.#wakeWaiter();
+  }
+
+  /** Stops handing out clients, and closes those that scope may close, now if idle or else on release. */
+  async end(scope: unknown = this) {
+    this.#ended = true;
+    for (const waiter of this.#waiters.splice(0)) waiter.resolve(null);
+    for (const entry of this.#idle.splice(0)) this.#close(entry, scope);
+  }
+
+  #usableBy(entry: PoolEntry, scope: unknown) {
+    return this.#shareAcrossRequests || entry.scope === scope;
+  }
+
+  #takeIdle(scope: unknown) {
+    for (let i = this.#idle.length - 1; i >= 0; i--) {  // most recently used first: likeliest to be alive
+      if (this.#usableBy(this.#idle[i], scope)) return this.#idle.splice(i, 1)[0];
+    }
+    return null;
+  }
+
+  #handOut(entry: PoolEntry, scope: unknown) {
+    if (!this.#shareAcrossRequests) entry.scope = scope;
+    this.#busy.set(entry.client, entry);
+    this.stats.reused++;
+    return entry.client;
+  }
+
+  async #open(scope: unknown) {
+    this.#opening++;
+    let client: Client | null = null;
+    try {
+      client = this.#createClient();
+      await client.connect();
+      this.stats.opened++;
+      this.#busy.set(client, { client, scope, idleSince: 0, closeOnRelease: false });
+      return client;
+    } catch (err) {
+      client?.end().catch(() => { });
+      throw err;
+    } finally {
+      this.#opening--;
+      if (client === null || !this.#busy.has(client)) this.#wakeWaiter();  // failed: its room is free again
+    }
+  }
+
+  async #isAlive(entry: PoolEntry) {
+    if (!entry.client.connected) return false;
+    if (Date.now() - entry.idleSince < this.#checkAfterIdleMs) return true;
+    try {
+      await entry.client.queryArray("SELECT 1");
+      return true;
+    } catch {
+      return false;
+    }
+  }
+
+  #expire(scope: unknown) {
+    const now = Date.now();
+    const expired = this.#idle.filter(entry => now - entry.idleSince > this.#idleTimeoutMs);
+    if (expired.length === 0) return;
+    this.#idle = this.#idle.filter(entry => !expired.includes(entry));
+    this.stats.expired += expired.length;
+    for (const entry of expired) this.#close(entry, scope);
+  }
+
+  // ends the client if this scope may do I/O on it; otherwise it's just dropped, and the runtime
+  // closes its socket along with the request that opened it
+  #close(entry: PoolEntry, scope: unknown) {
+    if (this.#usableBy(entry, scope)) entry.client.end().catch(() => { });
+  }
+
+  #wakeWaiter() {
+    const waiter = this.#waiters.shift();
+    if (waiter !== undefined) waiter.resolve(null);
+  }
+}
@@ -0,0 +1,28 @@
+import type { MuxTunnel } from "../src/wsmux";
+
+// where workerDenoPostgres_connect sends its WebSocket upgrade requests (see workers-override.ts)
+export const tunnel = { wsProxy: "http://proxy.hahathon.monster/", mux: null as MuxTunnel | null, directTls: false };
+
+/** Sets the WebSocket-to-TCP proxy for subsequent connections, e.g. a local one for testing. */
+export function setWsProxy(url: string) {
+  tunnel.wsProxy = url;
+}
+
+/**
+ * Makes subsequent connections share one WebSocket to the proxy, via mux (see src/wsmux.ts), or with
+ * null, go back to one WebSocket each. With a proxy that doesn't multiplex, they get one each anyway.
+ */
+export function setMuxTunnel(mux: MuxTunnel | null) {
+  tunnel.mux = mux;
+}
+
+/**
+ * Makes subsequent TLS connections negotiate TLS directly, like libpq's sslnegotiation=direct (PostgreSQL
+ * 17+): the ClientHello, offering ALPN "postgresql", goes out as soon as the socket is open, rather than
+ * after an SSLRequest and the server's reply, saving a round trip. A server that turns it down (anything
+ * older than 17) is asked again with an SSLRequest, on a new connection, and is remembered, so that later
+ * connections to it go straight to the SSLRequest.
+ */
+export function setDirectTls(enabled: boolean) {
+  tunnel.directTls = enabled;
+}
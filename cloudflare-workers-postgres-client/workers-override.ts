@@ -1,4 +1,5 @@
 import WsTls from '../src/wstls';
+import { tunnel } from './tunnel';
 
 declare namespace Deno {
   export interface Reader {
@@ -70,15 +71,30 @@ declare namespace Deno {
 
 type WsTlsInstance = Awaited<ReturnType<typeof WsTls>>;
 
+const SSL_REQUEST = new Uint8Array([0, 0, 0, 8, 0x04, 0xd2, 0x16, 0x2f]);  // length 8, code 80877103
+const SSL_ACCEPTED = "S".charCodeAt(0);
+
+// host:port of servers that turned down direct TLS negotiation (see setDirectTls)
+const noDirectTls = new Set<string>();
+
+const isSslRequest = (p: Uint8Array) => p.length === SSL_REQUEST.length && p.every((b, i) => b === SSL_REQUEST[i]);
+
+function openWsTls(hostname: string, port: number) {
+  return WsTls(hostname, port, tunnel.wsProxy, { readAhead: true, coalesceWrites: true, mux: tunnel.mux });
+}
+
 export class TcpOverWebsocketConn implements Deno.Conn {
   localAddr: Deno.Addr = { transport: "tcp", hostname: "localhost", port: 5432 };
   remoteAddr: Deno.Addr = { transport: "tcp", hostname: "172.17.0.2", port: 5432 };
   rid: number = 1;
 
   ws: WsTlsInstance;
+  directTls: boolean;  // the driver's SSLRequest is answered here, and never sent (see setDirectTls)
+  #sslReply: number | null = null;
 
-  constructor(ws: WsTlsInstance) {
+  constructor(ws: WsTlsInstance, readonly hostname = "", readonly port = 5432, directTls = false) {
     this.ws = ws;
+    this.directTls = directTls;
   }
 
   closeWrite(): Promise<void> {
@@ -87,11 +103,20 @@ export class TcpOverWebsocketConn implements Deno.Conn {
 
   // Reads up to p.length bytes from our buffer
   async read(p: Uint8Array) {
+    if (this.#sslReply !== null && p.length > 0) {
+      p[0] = this.#sslReply;
+      this.#sslReply = null;
+      return 1;
+    }
     const bytesRead = await this.ws.readData(p);
     return bytesRead;
   }
 
   async write(p: Uint8Array) {
+    if (this.directTls && isSslRequest(p)) {
+      this.#sslReply = SSL_ACCEPTED;  // so the driver goes straight on to startTls, and the ClientHello
+      return p.length;
+    }
     await this.ws.writeData(p);
 
     // we must assume the socket buffered our entire message
@@ -101,13 +126,48 @@ export class TcpOverWebsocketConn implements Deno.Conn {
   close(): void {
     this.ws.close();
   }
+
+  // replaces a connection on which direct negotiation failed with a new one, on which the SSLRequest is sent
+  async requestTls() {
+    this.ws.close();
+    this.ws = await openWsTls(this.hostname, this.port);
+    this.directTls = false;
+
+    await this.ws.writeData(SSL_REQUEST);
+    const reply = new Uint8Array(1);
+    if (await this.ws.readData(reply) !== 1 || reply[0] !== SSL_ACCEPTED) {
+      throw new Error("The server does not support TLS connections");
+    }
+  }
+
+  // TLS and transport counters for this connection, e.g. to log once per request (see TlsStats)
+  getStats() {
+    return this.ws.getStats();
+  }
 }
 
 export const workerDenoPostgres_startTls = async function (
-  connection: Deno.Conn
+  connection: Deno.Conn,
+  options?: { hostname?: string, caCerts?: string[] }
 ): Promise<Deno.Conn> {
 
-  await (connection as any).ws.startTls();
+  // a client's tls.caCertificates, if any, are trusted too (BearSSL: instead of the built-in roots)
+  const caCert = options?.caCerts?.length ? options.caCerts.join('\n') : undefined;
+  const conn = connection as TcpOverWebsocketConn;
+  if (!conn.directTls) {
+    await conn.ws.startTls(caCert);
+    return connection;
+  }
+
+  // PostgreSQL 17 accepts a ClientHello in place of the SSLRequest, provided it offers ALPN postgresql;
+  // an older server takes it for a malformed startup packet and hangs up
+  const status = await conn.ws.startTls(caCert, "postgresql").catch(() => -1);
+  if (status === 0 && conn.ws.alpnSelected()) return connection;
+
+  // a genuine failure (e.g. of the cert) recurs here, and is thrown, before anything is remembered
+  await conn.requestTls();
+  if (await conn.ws.startTls(caCert) !== 0) throw new Error("TLS handshake failed");
+  noDirectTls.add(`${conn.hostname}:${conn.port}`);
   return connection;
 };
 
@@ -119,8 +179,8 @@ export const workerDenoPostgres_connect = async function (
       throw new Error("Tunnel hostname undefined");
     }
 
-    const wsProxy = 'http://proxy.hahathon.monster/';
-    const wsTls = await WsTls(options.hostname, options.port, wsProxy, false);
+    const wsTls = await openWsTls(options.hostname, options.port);
+    const directTls = tunnel.directTls && !noDirectTls.has(`${options.hostname}:${options.port}`);
 
-    return new TcpOverWebsocketConn(wsTls);
+    return new TcpOverWebsocketConn(wsTls, options.hostname, options.port, directTls);
 };
@@ -0,0 +1,112 @@
+#!/usr/bin/env node
+
+// usage: node gentrust.mjs [bundle.pem ...]  (default: certs/roots.pem)
+//
+// Turns a bundle of PEM root certificates into static, pre-decoded trust anchor tables for the TLS
+// shims, so that no PEM is parsed at runtime:
+//   src/trust_anchors_bearssl.h  br_x509_trust_anchor TAs[] (DN + public key, as brssl's "ta" makes)
+//   src/trust_anchors_der.h      the DER for WolfSSL, loaded once per module instance by initContext
+
+import { X509Certificate } from 'node:crypto';
+import { readFileSync, writeFileSync } from 'node:fs';
+
+const bundles = process.argv.length > 2 ? process.argv.slice(2) : ['certs/roots.pem'];
+
+// returns [headerLength, contentLength] for the DER TLV at offset
+function tlv(der, offset) {
+  let len = der[offset + 1];
+  let headerLength = 2;
+  if (len & 0x80) {
+    const n = len & 0x7f;
+    len = 0;
+    for (let i = 0; i < n; i++) len = len * 256 + der[offset + 2 + i];
+    headerLength += n;
+  }
+  return [headerLength, len];
+}
+
+// the raw subject DN: Certificate > tbsCertificate > [version], serial, signature, issuer, validity, subject
+function subjectDN(der) {
+  let [h] = tlv(der, 0);
+  let offset = h;  // into tbsCertificate
+  [h] = tlv(der, offset);
+  offset += h;  // its first field
+  if (der[offset] === 0xa0) offset += tlv(der, offset).reduce((a, b) => a + b);  // explicit version
+  for (let i = 0; i < 4; i++) offset += tlv(der, offset).reduce((a, b) => a + b);
+  const [sh, sl] = tlv(der, offset);
+  return der.subarray(offset, offset + sh + sl);
+}
+
+function cArray(name, bytes) {
+  const lines = [];
+  for (let i = 0; i < bytes.length; i += 12) {
+    lines.push('  ' + [...bytes.subarray(i, i + 12)].map(b => '0x' + b.toString(16).toUpperCase().padStart(2, '0')).join(', '));
+  }
+  return `static const unsigned char ${name}[] = {\n${lines.join(',\n')}\n};\n`;
+}
+
+const curves = { 'P-256': 'BR_EC_secp256r1', 'P-384': 'BR_EC_secp384r1', 'P-521': 'BR_EC_secp521r1' };
+
+const certs = [];
+for (const bundle of bundles) {
+  const pem = readFileSync(bundle, 'utf8');
+  for (const block of pem.match(/-----BEGIN CERTIFICATE-----[^-]+-----END CERTIFICATE-----/g) ?? []) {
+    certs.push(new X509Certificate(block));
+  }
+}
+if (certs.length === 0) throw new Error(`no certificates found in ${bundles.join(', ')}`);
+
+const preamble = `// generated by gentrust.mjs from ${bundles.join(', ')}: edit the bundle and regenerate, not this file\n`;
+let bear = preamble + '\n';
+let der = preamble + '\n';
+const anchors = [];
+const ders = [];
+
+certs.forEach((cert, i) => {
+  const comment = `// ${cert.subject.replace(/\n/g, ', ')} (expires ${cert.validTo})\n`;
+  const raw = new Uint8Array(cert.raw);
+  const jwk = cert.publicKey.export({ format: 'jwk' });
+
+  bear += comment + cArray(`TA${i}_DN`, subjectDN(raw)) + '\n';
+  if (jwk.kty === 'RSA') {
+    bear += cArray(`TA${i}_RSA_N`, Buffer.from(jwk.n, 'base64url')) + '\n';
+    bear += cArray(`TA${i}_RSA_E`, Buffer.from(jwk.e, 'base64url')) + '\n';
+    anchors.push(`  {
+    { (unsigned char *)TA${i}_DN, sizeof TA${i}_DN },
+    ${cert.ca ? 'BR_X509_TA_CA' : '0'},
+    {
+      BR_KEYTYPE_RSA,
+      { .rsa = {
+        (unsigned char *)TA${i}_RSA_N, sizeof TA${i}_RSA_N,
+        (unsigned char *)TA${i}_RSA_E, sizeof TA${i}_RSA_E,
+      } }
+    }
+  }`);
+  } else if (jwk.kty === 'EC' && curves[jwk.crv]) {
+    const q = Buffer.concat([Buffer.from([4]), Buffer.from(jwk.x, 'base64url'), Buffer.from(jwk.y, 'base64url')]);
+    bear += cArray(`TA${i}_EC_Q`, q) + '\n';
+    anchors.push(`  {
+    { (unsigned char *)TA${i}_DN, sizeof TA${i}_DN },
+    ${cert.ca ? 'BR_X509_TA_CA' : '0'},
+    {
+      BR_KEYTYPE_EC,
+      { .ec = {
+        ${curves[jwk.crv]},
+        (unsigned char *)TA${i}_EC_Q, sizeof TA${i}_EC_Q,
+      } }
+    }
+  }`);
+  } else {
+    throw new Error(`unsupported key type in ${cert.subject}`);
+  }
+
+  der += comment + cArray(`TA${i}_DER`, raw) + '\n';
+  ders.push(`  { TA${i}_DER, sizeof TA${i}_DER }`);
+});
+
+bear += `static const br_x509_trust_anchor TAs[${anchors.length}] = {\n${anchors.join(',\n')}\n};\n\n#define TAs_NUM ${anchors.length}\n`;
+der += `static const struct { const unsigned char *data; int len; } TAs_DER[${ders.length}] = {\n${ders.join(',\n')}\n};\n\n#define TAs_NUM ${ders.length}\n`;
+
+writeFileSync('src/trust_anchors_bearssl.h', bear);
+writeFileSync('src/trust_anchors_der.h', der);
+console.log(`wrote ${certs.length} trust anchors`);
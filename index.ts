@@ -17,6 +17,36 @@ export interface Env {
   DB_DATABASE?: string;
 }
 
+/*
+// for the pooled version of fetch (below), which needs pg/ rebuilt from this tree (./buildwolf.sh or
+// ./buildbear.sh), since the committed bundle predates KeepAlivePool and copyOutStream; import
+// KeepAlivePool too
+
+// isolate-scoped, so that the same isolate's requests can share warm connections where the runtime
+// allows it (see KeepAlivePool: in a plain Worker, each request still gets its own)
+let pool: KeepAlivePool | null = null;
+
+// streams a large result into the response as it's read, so memory use stays flat however many rows
+// there are: the stream only reads from the connection as the client takes the response body
+async function exportCsv(pool: KeepAlivePool, ctx: ExecutionContext) {
+  const client = await pool.connect(ctx);
+  let csv: ReadableStream<Uint8Array>;
+  try {
+    csv = await client.copyOutStream("COPY (SELECT n, md5(n::text) FROM generate_series(1, 1000000) n) TO STDOUT WITH (FORMAT csv)");
+  } catch (err) {
+    pool.release(client, true);
+    throw err;
+  }
+
+  const { readable, writable } = new TransformStream();
+  ctx.waitUntil(csv.pipeTo(writable)
+    .then(() => pool.release(client), () => pool.release(client, true))
+    .then(() => pool.endScope(ctx)));
+
+  return new Response(readable, { headers: { 'Content-Type': 'text/csv' } });
+}
+*/
+
 export default {
   async fetch(request: Request, env: Env, ctx: ExecutionContext): Promise<Response> {
     const url = new URL(request.url);
@@ -29,7 +59,7 @@ export default {
       port: env.DB_PORT ?? 5432,
       database: env.DB_DATABASE ?? 'main',
     });
-    
+
     await client.connect();
     const array_result = await client.queryArray("SELECT now()");
     ctx.waitUntil(client.end());
@@ -40,6 +70,38 @@ export default {
       lng: request.cf.longitude,
     }, null, 2), { headers: { 'Content-Type': 'application/json' } });
 
+    /*
+    // with a rebuilt pg/ (see above), this version shares warm connections via KeepAlivePool instead,
+    // and serves /export
+
+    pool ??= new KeepAlivePool(() => new Client({
+      user: env.DB_USER,
+      password: env.DB_PASSWORD,
+      hostname: env.DB_HOST,
+      port: env.DB_PORT ?? 5432,
+      database: env.DB_DATABASE ?? 'main',
+    }));
+
+    if (url.pathname === '/export') return exportCsv(pool, ctx);
+
+    const client = await pool.connect(ctx);
+    let array_result;
+    try {
+      array_result = await client.queryArray("SELECT now()");
+      pool.release(client);
+    } catch (err) {
+      pool.release(client, true);
+      throw err;
+    }
+    ctx.waitUntil(pool.endScope(ctx));
+
+    return new Response(JSON.stringify({
+      rows: array_result.rows,
+      lat: request.cf.latitude,
+      lng: request.cf.longitude,
+    }, null, 2), { headers: { 'Content-Type': 'application/json' } });
+    */
+
     /*
     // this example fetches a web page over https instead
     
@@ -0,0 +1,58 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+/*
+ * The static-memory build (STATIC_MEMORY: ./buildwolf.sh static, ./buildbear.sh static) gives each
+ * connection slot a fixed arena, from which the shims bump-allocate their buffers, and which is reset
+ * when the slot is reused, so the shims never call malloc and the heap can be made fixed-size. A
+ * buffer grows in place if it was the arena's last allocation, and otherwise moves to the top,
+ * leaving its old space unused until the reset: buffers double as they grow, so that's bounded by
+ * their final sizes. The counts go in TlsStats, to size ARENA_SIZE by.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define ARENA_ALIGN 8
+
+typedef struct {
+  unsigned char *base;
+  size_t size;
+  size_t used;  // never goes down until the reset, so this is also the peak
+  size_t last;  // offset of the last allocation, which can grow in place
+  uint32_t allocs;
+} Arena;
+
+static void arenaReset(Arena *a, unsigned char *base, size_t size) {
+  a->base = base;
+  a->size = size;
+  a->used = a->last = 0;
+  a->allocs = 0;
+}
+
+static void *arenaAlloc(Arena *a, size_t len) {
+  len = (len + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+  if (len > a->size - a->used) return NULL;
+
+  a->last = a->used;
+  a->used += len;
+  a->allocs++;
+  return a->base + a->last;
+}
+
+// like realloc, but it needs the old size, and there's no free
+static void *arenaRealloc(Arena *a, void *p, size_t oldLen, size_t len) {
+  if (p != NULL && (unsigned char *)p == a->base + a->last) {
+    size_t grown = (len + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    if (grown > a->size - a->last) return NULL;
+    a->used = a->last + grown;
+    return p;
+  }
+
+  void *q = arenaAlloc(a, len);
+  if (q != NULL && p != NULL) memcpy(q, p, oldLen < len ? oldLen : len);
+  return q;
+}
+
+#endif
@@ -1,51 +1,242 @@
-#include <emscripten.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "bearssl.h"
+#include "platform.h"
+#include "stats.h"
+
+#ifdef STATIC_MEMORY
+#include "arena.h"
+#endif
+
+#ifdef USESUBTLECB
+#include <emscripten.h>
+#include <limits.h>
+#include <stddef.h>
+#endif
+
+// status codes returned by the non-blocking API, and by non-blocking connections (see tlsSetNonBlocking)
+#define TLS_WANT_READ -2
+#define TLS_WANT_WRITE -3
+
+#if defined(STATIC_MEMORY) && defined(NONBLOCKING)
+#error "JS pushes ciphertext into the non-blocking build as it arrives, so its input buffer can't be fixed"
+#endif
+
+#if defined(NONBLOCKING) && defined(USESUBTLECB)
+#error "WebCrypto is async, so the WebCrypto record layer can't be used in the non-blocking build"
+#endif
+
+#if defined(USESUBTLECB) && !defined(__EMSCRIPTEN__)
+#error "the WebCrypto record layer needs emscripten"
+#endif
+
+#ifdef LEAN_MEMORY
+  // the lean profile (./buildbear.sh lean): engine buffers sized for records of at most MAX_FRAGMENT
+  // bytes, which makes BearSSL ask the server for them (max_fragment_length, RFC 6066: 512, 1024,
+  // 2048 or 4096); servers that ignore the extension will fail with BR_ERR_TOO_LARGE
+  #ifndef MAX_FRAGMENT
+    #define MAX_FRAGMENT 4096
+  #endif
+  #define IBUF_SIZE (BR_SSL_BUFSIZE_INPUT - 16384 + MAX_FRAGMENT)
+  #define OBUF_SIZE (BR_SSL_BUFSIZE_OUTPUT - 16384 + MAX_FRAGMENT)
+  #define RECV_AHEAD_SIZE (MAX_FRAGMENT + 512)  // a full record, with its header and expansion
+  #define BUFFER_MIN_CAP 1024
+#else
+  #define IBUF_SIZE BR_SSL_BUFSIZE_INPUT
+  #define OBUF_SIZE BR_SSL_BUFSIZE_OUTPUT
+  #define RECV_AHEAD_SIZE 32768  // ciphertext asked of JS per network read: whatever has arrived, up to this
+  #define BUFFER_MIN_CAP 16384
+#endif
 
-br_ssl_client_context sc;
-br_x509_minimal_context xc;
-unsigned char iobuf[BR_SSL_BUFSIZE_BIDI];
+#ifdef STATIC_MEMORY
+  // the static-memory build (./buildbear.sh static): BearSSL itself never allocates, and the shim
+  // allocates from a fixed arena per connection (see arena.h), in a fixed table of MAX_CONNECTIONS
+  #ifndef ARENA_SIZE
+    #ifdef LEAN_MEMORY
+      #define ARENA_SIZE (16 * 1024)
+    #else
+      #define ARENA_SIZE (80 * 1024)  // read-ahead, staged output, and a root cert passed to tlsOpen
+    #endif
+  #endif
+#endif
+
+typedef struct {
+  unsigned char *data;
+  size_t start;
+  size_t end;
+  size_t cap;
+  #ifdef STATIC_MEMORY
+    Arena *arena;  // what it grows into
+  #endif
+} Buffer;
+
+typedef struct {
+  int id;
+  char *host;  // kept for the client reset when resuming a session
+  unsigned char offeredSessionId[32];
+  size_t offeredSessionIdLen;
+  char alpn[32];  // the protocol name offered by tlsSetAlpn, which BearSSL doesn't copy
+  const char *alpnNames[1];
+  br_ssl_client_context sc;
+  br_x509_minimal_context xc;
+  br_x509_trust_anchor ta;  // if a root cert was passed to tlsOpen, it's used instead of TAs (below)
+  Buffer taDN, taKey;
+  unsigned char iobuf[IBUF_SIZE + OBUF_SIZE];  // not half-duplex: plaintext lent by readDataInPlace would block writes
+  size_t lent;  // plaintext handed out in place by readDataInPlace, acknowledged on the next call
+  Buffer output;  // ciphertext produced by BearSSL, not yet taken by (or sent via) JS
+  Buffer input;  // ciphertext from JS (pushed in, or read ahead), not yet consumed by BearSSL
+  TlsStats stats;
+  #ifdef NONBLOCKING
+    int inputClosed;
+  #else
+    br_sslio_context ioc;
+    int nonBlocking;  // see tlsSetNonBlocking
+  #endif
+  #ifdef STATIC_MEMORY
+    Arena arena;
+    unsigned char arenaSpace[ARENA_SIZE];  // last, so that clearing a slot can skip it
+  #endif
+} Connection;
+
+#ifdef __wasm_simd128__
+  uint32_t chacha20SimdRun(const void *key, const void *iv, uint32_t cc, void *data, size_t len);  // chacha20_simd.c
+#endif
+
+// the trust anchors (below) are shared by all connections
+Connection *connections[MAX_CONNECTIONS];
+#ifdef STATIC_MEMORY
+  Connection connectionSlots[MAX_CONNECTIONS];
+#endif
 unsigned char entropy[128];
-br_sslio_context ioc;
 int ret;
 int err;
 
-// === JS functions exposed to C ===
+// === I/O callbacks (via platform.h, i.e. to/from WebSockets in JS) ===
 
-EM_ASYNC_JS(int, jsProvideEncryptedFromNetwork, (unsigned char *buf, size_t len), {
-  const bytesRead = await Module.provideEncryptedFromNetwork(buf, len);
-  return bytesRead;
-});
+// makes room for len more bytes at the end of the buffer, returning a pointer to that space
+static unsigned char *bufferReserve(Buffer *b, size_t len) {
+  if (b->start > 0 && b->end + len > b->cap) {  // compact
+    memmove(b->data, b->data + b->start, b->end - b->start);
+    b->end -= b->start;
+    b->start = 0;
+  }
+  if (b->end + len > b->cap) {  // grow
+    size_t cap = b->cap == 0 ? BUFFER_MIN_CAP : b->cap;
+    while (cap < b->end + len) cap *= 2;
+    #ifdef STATIC_MEMORY
+      unsigned char *data = arenaRealloc(b->arena, b->data, b->cap, cap);
+    #else
+      unsigned char *data = realloc(b->data, cap);
+    #endif
+    if (data == NULL) return NULL;
+    b->data = data;
+    b->cap = cap;
+  }
+  return b->data + b->end;
+}
 
-EM_JS(int, jsWriteEncryptedToNetwork, (const unsigned char *buf, size_t len), {
-  const bytesWritten = Module.writeEncryptedToNetwork(buf, len);
-  return bytesWritten;
-});
+static void bufferFree(Buffer *b) {
+  #ifndef STATIC_MEMORY  // otherwise it goes with the arena
+    free(b->data);
+  #endif
+}
 
-EM_JS(int, jsReceiveDecryptedFromLibrary, (unsigned char *buf, size_t len), {
-  Module.jsReceiveDecryptedFromLibrary(buf, len);
-});
+#ifdef NONBLOCKING
 
-EM_JS(void, jsGetRandomBytes, (unsigned char *buf, size_t len), {
-  const arr = Module.HEAPU8.subarray(buf, buf + len);
-  crypto.getRandomBytes(arr);
-});
+static int sock_read(void *ctx, unsigned char *buf, size_t len) {  // returns 0 only once input is closed
+  Connection *conn = (Connection *)ctx;
+  size_t avail = conn->input.end - conn->input.start;
+  if (len > avail) len = avail;
+
+  memcpy(buf, conn->input.data + conn->input.start, len);
+  conn->input.start += len;
+  return len;
+}
+
+static int sock_write(void *ctx, const unsigned char *buf, size_t len) {
+  Connection *conn = (Connection *)ctx;
+  unsigned char *space = bufferReserve(&conn->output, len);
+  if (space == NULL) return -1;
+
+  memcpy(space, buf, len);
+  conn->output.end += len;
+  return len;
+}
+
+static int flushEncrypted(Connection *conn) {  // nothing to do: JS takes the output buffer after every call
+  return 0;
+}
+
+#else
+
+// ciphertext is staged in the output buffer and handed over in one piece, rather than record by
+// record, at the end of each call and before we wait for the server
+static int flushEncrypted(Connection *conn) {
+  size_t len = conn->output.end - conn->output.start;
+  if (len == 0) return 0;
 
+  #ifdef CHATTY
+    printf("sending %zu staged bytes to JS\n", len);
+  #endif
+
+  int sent = platformSend(conn->id, conn->output.data + conn->output.start, len);
+  conn->output.start = conn->output.end = 0;
+  return sent < 0 ? -1 : 0;
+}
+
+// refills the (empty) input buffer with everything JS has queued, up to RECV_AHEAD_SIZE, suspending
+// only if nothing has arrived (or, if !wait, returning PLATFORM_WOULD_BLOCK): BearSSL asks for each
+// record's header and then its body, and this way both, and any further records that came in the
+// same message, are served from memory
+static int fillInput(Connection *conn, int wait) {
+  if (flushEncrypted(conn) < 0) return -1;
 
-// === I/O callbacks to/from WebSockets in JS ===
+  conn->input.start = conn->input.end = 0;
+  unsigned char *space = bufferReserve(&conn->input, RECV_AHEAD_SIZE);
+  if (space == NULL) return -1;
+
+  int recvd = platformRecvNow(conn->id, space, RECV_AHEAD_SIZE);
+  if (recvd == PLATFORM_WOULD_BLOCK) {
+    if (!wait) return recvd;
+    recvd = platformRecv(conn->id, space, RECV_AHEAD_SIZE);
+    #ifdef __EMSCRIPTEN__
+      conn->stats.suspensions++;
+    #endif
+  }
+  conn->stats.networkReads++;
+  if (recvd > 0) {
+    conn->stats.networkBytes += recvd;
+    conn->input.end += recvd;
+  }
+
+  #ifdef CHATTY
+    printf("received %d bytes from JS\n\n", recvd);
+  #endif
+
+  return recvd;
+}
 
 static int sock_read(void *ctx, unsigned char *buf, size_t len) {
-  int recvd = jsProvideEncryptedFromNetwork(buf, len);
+  Connection *conn = (Connection *)ctx;
+  if (conn->input.end == conn->input.start) {
+    int recvd = fillInput(conn, 1);
+    if (recvd <= 0) return -1;  // BearSSL treats EOF as an error too
+  }
+
+  size_t avail = conn->input.end - conn->input.start;
+  if (len > avail) len = avail;
+  memcpy(buf, conn->input.data + conn->input.start, len);
+  conn->input.start += len;
 
   #ifdef CHATTY
     printf("%s", "recv:");
     for (int i = 0; i < len; i++) printf(" %02x", (unsigned char)buf[i]);
-    printf("\nreceived %d bytes from JS\n\n", recvd);
+    printf("\n");
   #endif
 
-  return recvd;
+  return len;
 }
 
 static int sock_write(void *ctx, const unsigned char *buf, size_t len) {
@@ -54,103 +245,492 @@ static int sock_write(void *ctx, const unsigned char *buf, size_t len) {
     for (int i = 0; i < len; i++) printf(" %02x", (unsigned char)buf[i]);
   #endif
 
-  int sent = jsWriteEncryptedToNetwork(buf, len);
+  Connection *conn = (Connection *)ctx;
+  unsigned char *space = bufferReserve(&conn->output, len);
+  #ifdef STATIC_MEMORY
+    if (space == NULL && flushEncrypted(conn) == 0) space = bufferReserve(&conn->output, len);  // the arena is full
+  #endif
+  if (space == NULL) return -1;
+
+  memcpy(space, buf, len);
+  conn->output.end += len;
 
   #ifdef CHATTY
-    printf("\nsent %d bytes to JS\n\n", sent);
+    printf("\nstaged %zu bytes\n\n", len);
   #endif
 
-  return sent;
+  return len;
 }
 
+#endif
+
 // === CA cert(s) ===
 
-/*
- * C code for hardcoded trust anchors can be generated with the "brssl"
- * command-line tool (with the "ta" command).
- */
-
-static const unsigned char TA0_DN[] = {
-  0x30, 0x4F, 0x31, 0x0B, 0x30, 0x09, 0x06, 0x03, 0x55, 0x04, 0x06, 0x13,
-  0x02, 0x55, 0x53, 0x31, 0x29, 0x30, 0x27, 0x06, 0x03, 0x55, 0x04, 0x0A,
-  0x13, 0x20, 0x49, 0x6E, 0x74, 0x65, 0x72, 0x6E, 0x65, 0x74, 0x20, 0x53,
-  0x65, 0x63, 0x75, 0x72, 0x69, 0x74, 0x79, 0x20, 0x52, 0x65, 0x73, 0x65,
-  0x61, 0x72, 0x63, 0x68, 0x20, 0x47, 0x72, 0x6F, 0x75, 0x70, 0x31, 0x15,
-  0x30, 0x13, 0x06, 0x03, 0x55, 0x04, 0x03, 0x13, 0x0C, 0x49, 0x53, 0x52,
-  0x47, 0x20, 0x52, 0x6F, 0x6F, 0x74, 0x20, 0x58, 0x31
-};
+// TAs and TAs_NUM, generated from certs/roots.pem by gentrust.mjs
+#include "trust_anchors_bearssl.h"
+
+static void appendToBuffer(void *ctx, const void *data, size_t len) {  // a br_pem/br_x509 decoder callback
+  Buffer *b = (Buffer *)ctx;
+  unsigned char *space = bufferReserve(b, len);
+  if (space == NULL) return;
+
+  memcpy(space, data, len);
+  b->end += len;
+}
+
+// decodes the first certificate in a PEM buffer into conn->ta (cf. brssl's "ta" command)
+static int decodeTrustAnchor(Connection *conn, const unsigned char *pem, size_t len) {
+  br_pem_decoder_context pc;
+  Buffer der = { 0 };
+  #ifdef STATIC_MEMORY
+    der.arena = &conn->arena;
+  #endif
+  int inCert = 0, found = 0, ended = 0;
+
+  br_pem_decoder_init(&pc);
+  while (!found) {
+    if (len == 0) {
+      if (ended) break;
+      pem = (const unsigned char *)"\n";  // in case the final line has no newline
+      len = 1;
+      ended = 1;
+    }
+    size_t n = br_pem_decoder_push(&pc, pem, len);
+    pem += n;
+    len -= n;
+
+    switch (br_pem_decoder_event(&pc)) {
+      case BR_PEM_BEGIN_OBJ:
+        inCert = strcmp(br_pem_decoder_name(&pc), "CERTIFICATE") == 0;
+        br_pem_decoder_setdest(&pc, inCert ? appendToBuffer : NULL, &der);
+        break;
+      case BR_PEM_END_OBJ:
+        found = inCert;
+        break;
+      case BR_PEM_ERROR:
+        bufferFree(&der);
+        return -1;
+    }
+  }
+  if (!found) {
+    bufferFree(&der);
+    return -1;
+  }
+
+  br_x509_decoder_context dc;
+  br_x509_decoder_init(&dc, appendToBuffer, &conn->taDN);
+  br_x509_decoder_push(&dc, der.data, der.end);
+  bufferFree(&der);
+
+  br_x509_pkey *pk = br_x509_decoder_get_pkey(&dc);
+  if (pk == NULL) {
+    printf("root cert decoding failed with error %i\n", br_x509_decoder_last_error(&dc));
+    return -1;
+  }
+
+  conn->ta.dn.data = conn->taDN.data;
+  conn->ta.dn.len = conn->taDN.end;
+  conn->ta.flags = br_x509_decoder_isCA(&dc) ? BR_X509_TA_CA : 0;
+  conn->ta.pkey.key_type = pk->key_type;
 
-static const unsigned char TA0_RSA_N[] = {
-  0xAD, 0xE8, 0x24, 0x73, 0xF4, 0x14, 0x37, 0xF3, 0x9B, 0x9E, 0x2B, 0x57,
-  0x28, 0x1C, 0x87, 0xBE, 0xDC, 0xB7, 0xDF, 0x38, 0x90, 0x8C, 0x6E, 0x3C,
-  0xE6, 0x57, 0xA0, 0x78, 0xF7, 0x75, 0xC2, 0xA2, 0xFE, 0xF5, 0x6A, 0x6E,
-  0xF6, 0x00, 0x4F, 0x28, 0xDB, 0xDE, 0x68, 0x86, 0x6C, 0x44, 0x93, 0xB6,
-  0xB1, 0x63, 0xFD, 0x14, 0x12, 0x6B, 0xBF, 0x1F, 0xD2, 0xEA, 0x31, 0x9B,
-  0x21, 0x7E, 0xD1, 0x33, 0x3C, 0xBA, 0x48, 0xF5, 0xDD, 0x79, 0xDF, 0xB3,
-  0xB8, 0xFF, 0x12, 0xF1, 0x21, 0x9A, 0x4B, 0xC1, 0x8A, 0x86, 0x71, 0x69,
-  0x4A, 0x66, 0x66, 0x6C, 0x8F, 0x7E, 0x3C, 0x70, 0xBF, 0xAD, 0x29, 0x22,
-  0x06, 0xF3, 0xE4, 0xC0, 0xE6, 0x80, 0xAE, 0xE2, 0x4B, 0x8F, 0xB7, 0x99,
-  0x7E, 0x94, 0x03, 0x9F, 0xD3, 0x47, 0x97, 0x7C, 0x99, 0x48, 0x23, 0x53,
-  0xE8, 0x38, 0xAE, 0x4F, 0x0A, 0x6F, 0x83, 0x2E, 0xD1, 0x49, 0x57, 0x8C,
-  0x80, 0x74, 0xB6, 0xDA, 0x2F, 0xD0, 0x38, 0x8D, 0x7B, 0x03, 0x70, 0x21,
-  0x1B, 0x75, 0xF2, 0x30, 0x3C, 0xFA, 0x8F, 0xAE, 0xDD, 0xDA, 0x63, 0xAB,
-  0xEB, 0x16, 0x4F, 0xC2, 0x8E, 0x11, 0x4B, 0x7E, 0xCF, 0x0B, 0xE8, 0xFF,
-  0xB5, 0x77, 0x2E, 0xF4, 0xB2, 0x7B, 0x4A, 0xE0, 0x4C, 0x12, 0x25, 0x0C,
-  0x70, 0x8D, 0x03, 0x29, 0xA0, 0xE1, 0x53, 0x24, 0xEC, 0x13, 0xD9, 0xEE,
-  0x19, 0xBF, 0x10, 0xB3, 0x4A, 0x8C, 0x3F, 0x89, 0xA3, 0x61, 0x51, 0xDE,
-  0xAC, 0x87, 0x07, 0x94, 0xF4, 0x63, 0x71, 0xEC, 0x2E, 0xE2, 0x6F, 0x5B,
-  0x98, 0x81, 0xE1, 0x89, 0x5C, 0x34, 0x79, 0x6C, 0x76, 0xEF, 0x3B, 0x90,
-  0x62, 0x79, 0xE6, 0xDB, 0xA4, 0x9A, 0x2F, 0x26, 0xC5, 0xD0, 0x10, 0xE1,
-  0x0E, 0xDE, 0xD9, 0x10, 0x8E, 0x16, 0xFB, 0xB7, 0xF7, 0xA8, 0xF7, 0xC7,
-  0xE5, 0x02, 0x07, 0x98, 0x8F, 0x36, 0x08, 0x95, 0xE7, 0xE2, 0x37, 0x96,
-  0x0D, 0x36, 0x75, 0x9E, 0xFB, 0x0E, 0x72, 0xB1, 0x1D, 0x9B, 0xBC, 0x03,
-  0xF9, 0x49, 0x05, 0xD8, 0x81, 0xDD, 0x05, 0xB4, 0x2A, 0xD6, 0x41, 0xE9,
-  0xAC, 0x01, 0x76, 0x95, 0x0A, 0x0F, 0xD8, 0xDF, 0xD5, 0xBD, 0x12, 0x1F,
-  0x35, 0x2F, 0x28, 0x17, 0x6C, 0xD2, 0x98, 0xC1, 0xA8, 0x09, 0x64, 0x77,
-  0x6E, 0x47, 0x37, 0xBA, 0xCE, 0xAC, 0x59, 0x5E, 0x68, 0x9D, 0x7F, 0x72,
-  0xD6, 0x89, 0xC5, 0x06, 0x41, 0x29, 0x3E, 0x59, 0x3E, 0xDD, 0x26, 0xF5,
-  0x24, 0xC9, 0x11, 0xA7, 0x5A, 0xA3, 0x4C, 0x40, 0x1F, 0x46, 0xA1, 0x99,
-  0xB5, 0xA7, 0x3A, 0x51, 0x6E, 0x86, 0x3B, 0x9E, 0x7D, 0x72, 0xA7, 0x12,
-  0x05, 0x78, 0x59, 0xED, 0x3E, 0x51, 0x78, 0x15, 0x0B, 0x03, 0x8F, 0x8D,
-  0xD0, 0x2F, 0x05, 0xB2, 0x3E, 0x7B, 0x4A, 0x1C, 0x4B, 0x73, 0x05, 0x12,
-  0xFC, 0xC6, 0xEA, 0xE0, 0x50, 0x13, 0x7C, 0x43, 0x93, 0x74, 0xB3, 0xCA,
-  0x74, 0xE7, 0x8E, 0x1F, 0x01, 0x08, 0xD0, 0x30, 0xD4, 0x5B, 0x71, 0x36,
-  0xB4, 0x07, 0xBA, 0xC1, 0x30, 0x30, 0x5C, 0x48, 0xB7, 0x82, 0x3B, 0x98,
-  0xA6, 0x7D, 0x60, 0x8A, 0xA2, 0xA3, 0x29, 0x82, 0xCC, 0xBA, 0xBD, 0x83,
-  0x04, 0x1B, 0xA2, 0x83, 0x03, 0x41, 0xA1, 0xD6, 0x05, 0xF1, 0x1B, 0xC2,
-  0xB6, 0xF0, 0xA8, 0x7C, 0x86, 0x3B, 0x46, 0xA8, 0x48, 0x2A, 0x88, 0xDC,
-  0x76, 0x9A, 0x76, 0xBF, 0x1F, 0x6A, 0xA5, 0x3D, 0x19, 0x8F, 0xEB, 0x38,
-  0xF3, 0x64, 0xDE, 0xC8, 0x2B, 0x0D, 0x0A, 0x28, 0xFF, 0xF7, 0xDB, 0xE2,
-  0x15, 0x42, 0xD4, 0x22, 0xD0, 0x27, 0x5D, 0xE1, 0x79, 0xFE, 0x18, 0xE7,
-  0x70, 0x88, 0xAD, 0x4E, 0xE6, 0xD9, 0x8B, 0x3A, 0xC6, 0xDD, 0x27, 0x51,
-  0x6E, 0xFF, 0xBC, 0x64, 0xF5, 0x33, 0x43, 0x4F
+  // the key points into the decoder context, so it needs copying
+  if (pk->key_type == BR_KEYTYPE_RSA) {
+    appendToBuffer(&conn->taKey, pk->key.rsa.n, pk->key.rsa.nlen);
+    appendToBuffer(&conn->taKey, pk->key.rsa.e, pk->key.rsa.elen);
+    if (conn->taKey.end != pk->key.rsa.nlen + pk->key.rsa.elen) return -1;
+    conn->ta.pkey.key.rsa.n = conn->taKey.data;
+    conn->ta.pkey.key.rsa.nlen = pk->key.rsa.nlen;
+    conn->ta.pkey.key.rsa.e = conn->taKey.data + pk->key.rsa.nlen;
+    conn->ta.pkey.key.rsa.elen = pk->key.rsa.elen;
+  } else {
+    appendToBuffer(&conn->taKey, pk->key.ec.q, pk->key.ec.qlen);
+    if (conn->taKey.end != pk->key.ec.qlen) return -1;
+    conn->ta.pkey.key.ec.curve = pk->key.ec.curve;
+    conn->ta.pkey.key.ec.q = conn->taKey.data;
+    conn->ta.pkey.key.ec.qlen = pk->key.ec.qlen;
+  }
+  return 0;
+}
+
+// === Connection table ===
+
+static Connection *getConnection(int id) {
+  if (id < 0 || id >= MAX_CONNECTIONS) return NULL;
+  return connections[id];
+}
+
+// drives the engine until it reaches one of the target states (cf. run_until in BearSSL's ssl_io.c)
+static int runUntil(Connection *conn, unsigned target) {
+  br_ssl_engine_context *eng = &conn->sc.eng;
+
+  for (;;) {
+    unsigned state = br_ssl_engine_current_state(eng);
+    if (state & BR_SSL_CLOSED) return -1;
+
+    if (state & BR_SSL_SENDREC) {
+      size_t len;
+      unsigned char *buf = br_ssl_engine_sendrec_buf(eng, &len);
+      int wlen = sock_write(conn, buf, len);
+      if (wlen <= 0) {
+        br_ssl_engine_fail(eng, BR_ERR_IO);
+        return -1;
+      }
+      br_ssl_engine_sendrec_ack(eng, wlen);
+      continue;
+    }
+
+    if (state & target) return 0;
+
+    if (state & BR_SSL_RECVAPP) return -1;  // application data is waiting, but that's not what we asked for
+
+    if (state & BR_SSL_RECVREC) {
+      #ifdef NONBLOCKING
+        if (conn->input.end == conn->input.start && !conn->inputClosed) return TLS_WANT_READ;
+      #else
+        if (conn->input.end == conn->input.start && conn->nonBlocking &&
+          fillInput(conn, 0) == PLATFORM_WOULD_BLOCK) return TLS_WANT_READ;
+      #endif
+      size_t len;
+      unsigned char *buf = br_ssl_engine_recvrec_buf(eng, &len);
+      int rlen = sock_read(conn, buf, len);
+      if (rlen <= 0) {
+        br_ssl_engine_fail(eng, BR_ERR_IO);
+        return -1;
+      }
+      br_ssl_engine_recvrec_ack(eng, rlen);
+      continue;
+    }
+
+    br_ssl_engine_flush(eng, 0);
+  }
+}
+
+// after runUntil fails: a closed engine with no error is a clean close, and so, in the non-blocking
+// build, is the BR_ERR_IO it's failed with once the socket has closed and all its input is consumed
+static int closedCleanly(Connection *conn) {
+  err = br_ssl_engine_last_error(&conn->sc.eng);
+  #ifdef NONBLOCKING
+    if (err == BR_ERR_IO && conn->inputClosed && conn->input.end == conn->input.start) return 1;
+  #endif
+  return err == BR_ERR_OK;
+}
+
+#ifdef USESUBTLECB
+
+// === AES-GCM records via WebCrypto (./buildbear.sh subtle) ===
+
+// a WebCrypto call costs an ASYNCIFY suspension and a round trip through JS whatever its size, so
+// only long records go to crypto.subtle, and short ones (most Postgres traffic) stay with BearSSL's
+// own GCM code, with the same keys and sequence numbers. As in src/wolfssl.c, the threshold (and the
+// suite order that goes with it) is measured by tlsCalibrate, or pinned from JS via tlsCryptoPolicy.
+#define AES_OFFLOAD_THRESHOLD 1024  // bytes
+
+typedef struct {  // read and written by wstls.ts (see CryptoPolicy there): the same layout as in src/wolfssl.c
+  int32_t aesOffloadThreshold;  // AES-GCM records at least this long go to WebCrypto (INT_MAX: none)
+  int32_t shaOffloadThreshold;  // unused here: BearSSL's hashing all stays in wasm
+  int32_t preferChaCha;  // offer ChaCha20-Poly1305 (always in wasm) ahead of AES-GCM
+  int32_t calibrated;  // set by tlsCalibrate, when it could measure
+} CryptoPolicy;
+
+CryptoPolicy policy = { AES_OFFLOAD_THRESHOLD, INT_MAX, 0, 0 };
+
+CryptoPolicy *tlsCryptoPolicy(void) {
+  return &policy;
+}
+
+// every WebCrypto call suspends, so each is counted and timed against its connection
+static void countCrypto(Connection *conn, int op, double started) {
+  conn->stats.cryptoMs[op] += emscripten_get_now() - started;
+  conn->stats.cryptoCalls[op]++;
+  conn->stats.suspensions++;
+}
+
+// keys only change at the end of a handshake, so each is imported when the engine switches to it,
+// while the Finished messages are still in flight, and cached by the address of its record context
+EM_JS(void, jsGcmSetKey, (const void *ctx, const unsigned char *key, size_t keyLen), {
+  if (Module.gcmKeys === undefined) Module.gcmKeys = new Map();
+  const keyData = Module.HEAPU8.slice(key, key + keyLen);
+  Module.gcmKeys.set(ctx, crypto.subtle.importKey('raw', keyData, { name: 'AES-GCM' }, false, ['encrypt', 'decrypt']));
+});
+
+EM_JS(void, jsGcmForgetKeys, (const void *in, const void *out), {
+  if (Module.gcmKeys === undefined) return;
+  Module.gcmKeys.delete(in);
+  Module.gcmKeys.delete(out);
+});
+
+// in place: len bytes of plaintext become ciphertext plus a 16-byte tag, or the reverse; returns 0,
+// or -1 if decryption fails
+EM_ASYNC_JS(int, jsGcmCrypt, (const void *ctx, int encrypt, const unsigned char *nonce, const unsigned char *aad,
+    unsigned char *data, size_t len), {
+  #ifdef CHATTY
+    console.log('crypto.subtle AES-GCM', encrypt ? 'encrypt' : 'decrypt', len);
+  #endif
+  try {
+    const key = await Module.gcmKeys.get(ctx);
+    const algorithm = {
+      name: 'AES-GCM',
+      iv: Module.HEAPU8.slice(nonce, nonce + 12),
+      additionalData: Module.HEAPU8.slice(aad, aad + 13),
+      tagLength: 128,
+    };
+    const input = Module.HEAPU8.subarray(data, data + len + (encrypt ? 0 : 16));  // copied before they return
+    const output = encrypt ? crypto.subtle.encrypt(algorithm, key, input) : crypto.subtle.decrypt(algorithm, key, input);
+    Module.HEAPU8.set(new Uint8Array(await output), data);
+    return 0;
+  } catch (err) {
+    return -1;
+  }
+});
+
+// the engine keeps its record contexts in unions, so ours (the engine's vtable pointer, then
+// BearSSL's own GCM context for the short records) has to fit there
+typedef struct {
+  const void *vtable;
+  br_sslrec_gcm_context soft;
+} SubtleGcmContext;
+
+_Static_assert(sizeof(SubtleGcmContext) <= sizeof(((br_ssl_engine_context *)0)->in) &&
+  sizeof(SubtleGcmContext) <= sizeof(((br_ssl_engine_context *)0)->out), "record context too big");
+
+static void putBigEndian(unsigned char *buf, uint64_t value, int len) {
+  while (len-- > 0) {
+    buf[len] = (unsigned char)value;
+    value >>= 8;
+  }
+}
+
+// TLS 1.2 AES-GCM (RFC 5288): the nonce is a 4-byte salt from the key block plus the 8 bytes sent
+// ahead of the ciphertext, and the additional data is the sequence number and the record's header
+static void gcmNonceAndAad(const SubtleGcmContext *cc, const unsigned char *explicitNonce, int recordType,
+    unsigned version, size_t len, unsigned char nonce[12], unsigned char aad[13]) {
+  memcpy(nonce, cc->soft.iv, 4);
+  memcpy(nonce + 4, explicitNonce, 8);
+  putBigEndian(aad, cc->soft.seq, 8);
+  aad[8] = (unsigned char)recordType;
+  putBigEndian(aad + 9, version, 2);
+  putBigEndian(aad + 11, len, 2);
+}
+
+static const br_sslrec_in_gcm_class subtleGcmIn;
+static const br_sslrec_out_gcm_class subtleGcmOut;
+
+static int subtleGcmCheckLength(const br_sslrec_in_class *const *ctx, size_t recordLen) {
+  const SubtleGcmContext *cc = (const SubtleGcmContext *)ctx;
+  return br_sslrec_in_gcm_vtable.inner.check_length((const br_sslrec_in_class *const *)&cc->soft.vtable.in, recordLen);
+}
+
+static unsigned char *subtleGcmDecrypt(const br_sslrec_in_class **ctx, int recordType, unsigned version,
+    void *payload, size_t *len) {
+  SubtleGcmContext *cc = (SubtleGcmContext *)ctx;
+  if (*len < 24 || *len - 24 < (size_t)policy.aesOffloadThreshold) {
+    return br_sslrec_in_gcm_vtable.inner.decrypt((const br_sslrec_in_class **)&cc->soft.vtable.in,
+      recordType, version, payload, len);
+  }
+
+  unsigned char *buf = (unsigned char *)payload + 8;  // after the explicit nonce
+  size_t plainLen = *len - 24;
+  unsigned char nonce[12], aad[13];
+  gcmNonceAndAad(cc, payload, recordType, version, plainLen, nonce, aad);
+  cc->soft.seq++;
+
+  Connection *conn = (Connection *)((unsigned char *)ctx - offsetof(Connection, sc.eng.in));
+  double started = emscripten_get_now();
+  int result = jsGcmCrypt(cc, 0, nonce, aad, buf, plainLen);
+  countCrypto(conn, STATS_AES_GCM_DECRYPT, started);
+  if (result != 0) return NULL;
+
+  *len = plainLen;
+  return buf;
+}
+
+static void subtleGcmInitIn(const br_sslrec_in_gcm_class **ctx, const br_block_ctr_class *bcImpl,
+    const void *key, size_t keyLen, br_ghash ghImpl, const void *iv) {
+  SubtleGcmContext *cc = (SubtleGcmContext *)ctx;
+  br_sslrec_in_gcm_vtable.init(&cc->soft.vtable.in, bcImpl, key, keyLen, ghImpl, iv);
+  cc->vtable = &subtleGcmIn;
+  jsGcmSetKey(cc, key, keyLen);
+}
+
+static void subtleGcmMaxPlaintext(const br_sslrec_out_class *const *ctx, size_t *start, size_t *end) {
+  const SubtleGcmContext *cc = (const SubtleGcmContext *)ctx;
+  br_sslrec_out_gcm_vtable.inner.max_plaintext((const br_sslrec_out_class *const *)&cc->soft.vtable.out, start, end);
+}
+
+static unsigned char *subtleGcmEncrypt(const br_sslrec_out_class **ctx, int recordType, unsigned version,
+    void *plaintext, size_t *len) {
+  SubtleGcmContext *cc = (SubtleGcmContext *)ctx;
+  const br_sslrec_out_class **soft = (const br_sslrec_out_class **)&cc->soft.vtable.out;
+  if (*len < (size_t)policy.aesOffloadThreshold) {
+    return br_sslrec_out_gcm_vtable.inner.encrypt(soft, recordType, version, plaintext, len);
+  }
+
+  unsigned char *buf = plaintext;
+  size_t plainLen = *len;
+  putBigEndian(buf - 8, cc->soft.seq, 8);  // the explicit nonce: the sequence number, as BearSSL does
+  unsigned char nonce[12], aad[13];
+  gcmNonceAndAad(cc, buf - 8, recordType, version, plainLen, nonce, aad);
+
+  Connection *conn = (Connection *)((unsigned char *)ctx - offsetof(Connection, sc.eng.out));
+  double started = emscripten_get_now();
+  int result = jsGcmCrypt(cc, 1, nonce, aad, buf, plainLen);
+  countCrypto(conn, STATS_AES_GCM_ENCRYPT, started);
+  if (result != 0) {  // not expected, but the engine can't take a failure here, so BearSSL does it
+    return br_sslrec_out_gcm_vtable.inner.encrypt(soft, recordType, version, plaintext, len);
+  }
+  cc->soft.seq++;
+
+  buf -= 13;  // the header, and the explicit nonce
+  buf[0] = (unsigned char)recordType;
+  putBigEndian(buf + 1, version, 2);
+  putBigEndian(buf + 3, plainLen + 24, 2);
+  *len = plainLen + 29;
+  return buf;
+}
+
+static void subtleGcmInitOut(const br_sslrec_out_gcm_class **ctx, const br_block_ctr_class *bcImpl,
+    const void *key, size_t keyLen, br_ghash ghImpl, const void *iv) {
+  SubtleGcmContext *cc = (SubtleGcmContext *)ctx;
+  br_sslrec_out_gcm_vtable.init(&cc->soft.vtable.out, bcImpl, key, keyLen, ghImpl, iv);
+  cc->vtable = &subtleGcmOut;
+  jsGcmSetKey(cc, key, keyLen);
+}
+
+static const br_sslrec_in_gcm_class subtleGcmIn = {
+  { sizeof(SubtleGcmContext), subtleGcmCheckLength, subtleGcmDecrypt },
+  subtleGcmInitIn
 };
 
-static const unsigned char TA0_RSA_E[] = {
-  0x01, 0x00, 0x01
+static const br_sslrec_out_gcm_class subtleGcmOut = {
+  { sizeof(SubtleGcmContext), subtleGcmMaxPlaintext, subtleGcmEncrypt },
+  subtleGcmInitOut
 };
 
-static const br_x509_trust_anchor TAs[1] = {
-  {
-    { (unsigned char *)TA0_DN, sizeof TA0_DN },
-    BR_X509_TA_CA,
-    {
-      BR_KEYTYPE_RSA,
-      { .rsa = {
-        (unsigned char *)TA0_RSA_N, sizeof TA0_RSA_N,
-        (unsigned char *)TA0_RSA_E, sizeof TA0_RSA_E,
-      } }
+// times both sides at sizes from a Postgres Sync up to a full record: the threshold is the smallest
+// size from which WebCrypto is faster all the way up. Returns 0, or -1 if the clock didn't advance
+// (in which case the policy is left alone).
+#define CALIBRATION_REPS 4
+
+int tlsCalibrate(void) {
+  static const size_t sizes[] = { 64, 256, 1024, 4096, 16384 };
+  const int nSizes = sizeof sizes / sizeof sizes[0];
+  enum { maxSize = 16384 };
+  static unsigned char buf[13 + maxSize + 16];  // room for the header, explicit nonce and tag
+  unsigned char key[16] = { 0 }, chachaKey[32] = { 0 }, iv[12] = { 0 }, aad[13] = { 0 }, tag[16];
+  SubtleGcmContext cc;
+
+  // the implementations the engine uses (see tlsOpen)
+  #ifdef __wasm_simd128__
+    br_sslrec_out_gcm_vtable.init(&cc.soft.vtable.out, &br_aes_ct64_ctr_vtable, key, sizeof key, &br_ghash_ctmul64, iv);
+    br_chacha20_run chacha = &chacha20SimdRun;
+  #else
+    br_sslrec_out_gcm_vtable.init(&cc.soft.vtable.out, &br_aes_ct_ctr_vtable, key, sizeof key, &br_ghash_ctmul, iv);
+    br_chacha20_run chacha = &br_chacha20_ct_run;
+  #endif
+  const br_sslrec_out_class **soft = (const br_sslrec_out_class **)&cc.soft.vtable.out;
+  jsGcmSetKey(&cc, key, sizeof key);
+
+  int threshold = INT_MAX, winning = 1;
+  double wasmMs = 0, fastestMs = 0;
+  for (int i = nSizes - 1; i >= 0; i--) {  // largest first, so the threshold stops at the first loss
+    size_t len = sizes[i];
+
+    double started = emscripten_get_now();
+    for (int r = 0; r < CALIBRATION_REPS; r++) {
+      size_t recordLen = len;
+      br_sslrec_out_gcm_vtable.inner.encrypt(soft, BR_SSL_APPLICATION_DATA, BR_TLS12, buf + 13, &recordLen);
+    }
+    double aesWasmMs = emscripten_get_now() - started;
+    if (aesWasmMs == 0) {  // the clock is stopped (as in Workers), so stop before any WebCrypto
+      jsGcmForgetKeys(&cc, &cc);
+      return -1;
     }
+
+    started = emscripten_get_now();
+    for (int r = 0; r < CALIBRATION_REPS; r++) jsGcmCrypt(&cc, 1, iv, aad, buf + 13, len);
+    double aesJsMs = emscripten_get_now() - started;
+
+    if (winning && aesJsMs < aesWasmMs) threshold = len;
+    else winning = 0;
+    if (len == maxSize) fastestMs = aesJsMs < aesWasmMs ? aesJsMs : aesWasmMs;
+    wasmMs += aesWasmMs;
   }
-};
 
-#define TAs_NUM   1
+  double started = emscripten_get_now();
+  for (int r = 0; r < CALIBRATION_REPS; r++) {
+    br_poly1305_ctmul_run(chachaKey, iv, buf, maxSize, aad, sizeof aad, tag, chacha, 1);
+  }
+  double chaChaMs = emscripten_get_now() - started;
+  jsGcmForgetKeys(&cc, &cc);
+
+  if (wasmMs == 0) return -1;
+  policy.aesOffloadThreshold = threshold;
+  policy.preferChaCha = chaChaMs < fastestMs;
+  policy.calibrated = 1;
+
+  #ifdef CHATTY
+    printf("calibrated: AES-GCM offload from %i, prefer ChaCha %i\n", policy.aesOffloadThreshold, policy.preferChaCha);
+  #endif
+  return 0;
+}
+
+#endif
 
 // === TLS functions exposed to JavaScript ===
 
-int initTls(char *host) {
-  br_ssl_client_init_full(&sc, &xc, TAs, TAs_NUM);
-  br_ssl_engine_set_versions(&sc.eng, BR_TLS12, BR_TLS12);  // TLS 1.2 only, please
+static void freeConnection(Connection *conn) {
+  #ifdef USESUBTLECB
+    jsGcmForgetKeys(&conn->sc.eng.in, &conn->sc.eng.out);
+  #endif
+  bufferFree(&conn->taDN);
+  bufferFree(&conn->taKey);
+  bufferFree(&conn->output);
+  bufferFree(&conn->input);
+  #ifndef STATIC_MEMORY  // the slot is cleared when it's next used
+    free(conn->host);
+    free(conn);
+  #endif
+}
+
+// returns a connection id, or -1 on error; the handshake happens later, in tlsConnect
+// the optional rootCert (PEM) replaces the built-in trust anchors for this connection; BearSSL
+// can't send a server name without also checking it, so disableSNI isn't supported
+int tlsOpen(char *host, const unsigned char *rootCert, int rootCertLength, int disableSNI) {
+  int id = 0;
+  while (id < MAX_CONNECTIONS && connections[id] != NULL) id++;
+  if (id == MAX_CONNECTIONS) {
+    puts("too many connections");
+    return -1;
+  }
+
+  #ifdef STATIC_MEMORY
+    Connection *conn = &connectionSlots[id];
+    memset(conn, 0, offsetof(Connection, arenaSpace));
+    arenaReset(&conn->arena, conn->arenaSpace, ARENA_SIZE);
+    conn->taDN.arena = conn->taKey.arena = conn->output.arena = conn->input.arena = &conn->arena;
+    conn->host = arenaAlloc(&conn->arena, strlen(host) + 1);
+    if (conn->host != NULL) strcpy(conn->host, host);
+  #else
+    Connection *conn = calloc(1, sizeof(Connection));
+    if (conn == NULL) {
+      puts("failed to allocate connection");
+      return -1;
+    }
+    conn->host = strdup(host);
+  #endif
+  conn->id = id;
+
+  if (rootCertLength > 0) {
+    if (decodeTrustAnchor(conn, rootCert, rootCertLength) != 0) {
+      puts("failed to load root cert");
+      freeConnection(conn);
+      return -1;
+    }
+    br_ssl_client_init_full(&conn->sc, &conn->xc, &conn->ta, 1);
+  } else {
+    br_ssl_client_init_full(&conn->sc, &conn->xc, TAs, TAs_NUM);
+  }
+  br_ssl_engine_set_versions(&conn->sc.eng, BR_TLS12, BR_TLS12);  // TLS 1.2 only, please
 
   static const uint16_t suites[] = {  // matched to rustls: https://docs.rs/rustls/latest/src/rustls/suites.rs.html#125-143
     BR_TLS_ECDHE_ECDSA_WITH_CHACHA20_POLY1305_SHA256,
@@ -160,52 +740,183 @@ int initTls(char *host) {
     BR_TLS_ECDHE_RSA_WITH_AES_128_GCM_SHA256,
     BR_TLS_ECDHE_RSA_WITH_AES_256_GCM_SHA384
   };
-  br_ssl_engine_set_suites(&sc.eng, suites, (sizeof suites) / (sizeof suites[0]));  
+  br_ssl_engine_set_suites(&conn->sc.eng, suites, (sizeof suites) / (sizeof suites[0]));
+
+  #ifdef USESUBTLECB
+    static const uint16_t aesFirst[] = {  // unless calibration found ChaCha20 faster than AES-GCM via WebCrypto
+      BR_TLS_ECDHE_ECDSA_WITH_AES_128_GCM_SHA256,
+      BR_TLS_ECDHE_ECDSA_WITH_AES_256_GCM_SHA384,
+      BR_TLS_ECDHE_ECDSA_WITH_CHACHA20_POLY1305_SHA256,
+      BR_TLS_ECDHE_RSA_WITH_AES_128_GCM_SHA256,
+      BR_TLS_ECDHE_RSA_WITH_AES_256_GCM_SHA384,
+      BR_TLS_ECDHE_RSA_WITH_CHACHA20_POLY1305_SHA256
+    };
+    if (!policy.preferChaCha) br_ssl_engine_set_suites(&conn->sc.eng, aesFirst, (sizeof aesFirst) / (sizeof aesFirst[0]));
+  #endif
+
+  #ifdef __wasm_simd128__  // the SIMD (speed) build profile
+    br_ssl_engine_set_chacha20(&conn->sc.eng, &chacha20SimdRun);
+    // wasm has native 64-bit multiplies, so the 64-bit constant-time implementations win here,
+    // though BearSSL only picks them on 64-bit targets (there's no carryless multiply to vectorize)
+    br_ssl_engine_set_ghash(&conn->sc.eng, &br_ghash_ctmul64);
+    br_ssl_engine_set_aes_ctr(&conn->sc.eng, &br_aes_ct64_ctr_vtable);
+  #endif
+
+  #ifdef USESUBTLECB
+    br_ssl_engine_set_gcm(&conn->sc.eng, &subtleGcmIn, &subtleGcmOut);  // after the AES and GHASH choices, which it keeps
+  #endif
 
-  jsGetRandomBytes(&entropy, sizeof(entropy));
-  br_ssl_engine_inject_entropy(&sc.eng, entropy, sizeof(entropy));  // required with emscripten
-  br_ssl_engine_set_buffer(&sc.eng, iobuf, sizeof iobuf, 1);
+  platformRandom(entropy, sizeof(entropy));
+  br_ssl_engine_inject_entropy(&conn->sc.eng, entropy, sizeof(entropy));  // required with emscripten
+  br_ssl_engine_set_buffers_bidi(&conn->sc.eng, conn->iobuf, IBUF_SIZE, conn->iobuf + IBUF_SIZE, OBUF_SIZE);
 
-  ret = br_ssl_client_reset(&sc, host, 0);
+  ret = br_ssl_client_reset(&conn->sc, host, 0);
   if (ret != 1) {  // errors can occur here, e.g. no entropy available
-    err = br_ssl_engine_last_error(&sc.eng);
+    err = br_ssl_engine_last_error(&conn->sc.eng);
     printf("client reset failed with error %i\n", err);
+    freeConnection(conn);
     return -1;
   }
 
-  br_sslio_init(&ioc, &sc.eng, sock_read, NULL, sock_write, NULL);
+  #ifndef NONBLOCKING
+    br_sslio_init(&conn->ioc, &conn->sc.eng, sock_read, conn, sock_write, conn);
+  #endif
+
+  connections[id] = conn;
+  return id;
+}
+
+#ifndef NONBLOCKING
+// with ASYNCIFY, makes tlsConnect and readDataInPlace return TLS_WANT_READ, rather than suspend, when
+// they've used up what JS has queued: JS can then wait for the network without holding up other
+// connections' calls into the module (ASYNCIFY allows only one suspended call at a time)
+int tlsSetNonBlocking(int id, int nonBlocking) {
+  Connection *conn = getConnection(id);
+  if (conn == NULL) return -1;
+
+  conn->nonBlocking = nonBlocking;
+  return 0;
+}
+#endif
+
+int tlsConnect(int id) {  // run the handshake to completion, so that it doesn't delay the first read/write
+  Connection *conn = getConnection(id);
+  if (conn == NULL) return -1;
+
+  ret = runUntil(conn, BR_SSL_SENDAPP);
+  flushEncrypted(conn);
+  if (ret == TLS_WANT_READ) return ret;
+  if (ret != 0) {
+    err = br_ssl_engine_last_error(&conn->sc.eng);
+    printf("handshake failed with error %i\n", err);
+    return ret;
+  }
 
   return 0;
 }
 
-int writeData(unsigned char *buf, size_t len) {  // ask BearSSL to encrypt and send (via JS callback) data
+#ifdef NONBLOCKING
+
+int writeData(int id, unsigned char *buf, size_t len) {  // returns the number of bytes accepted, or a status code
+  Connection *conn = getConnection(id);
+  if (conn == NULL) return -1;
+
+  size_t written = 0;
+  while (written < len) {
+    ret = runUntil(conn, BR_SSL_SENDAPP);
+    if (ret != 0) {
+      if (written > 0) break;
+      if (ret != TLS_WANT_READ) {
+        err = br_ssl_engine_last_error(&conn->sc.eng);
+        printf("write failed with error %i\n", err);
+      }
+      return ret;
+    }
+
+    size_t alen;
+    unsigned char *abuf = br_ssl_engine_sendapp_buf(&conn->sc.eng, &alen);
+    if (alen > len - written) alen = len - written;
+    memcpy(abuf, buf + written, alen);
+    br_ssl_engine_sendapp_ack(&conn->sc.eng, alen);
+    written += alen;
+  }
+
+  // move the resulting records into the output buffer
+  br_ssl_engine_flush(&conn->sc.eng, 0);
+  while (br_ssl_engine_current_state(&conn->sc.eng) & BR_SSL_SENDREC) {
+    size_t rlen;
+    unsigned char *rbuf = br_ssl_engine_sendrec_buf(&conn->sc.eng, &rlen);
+    if (sock_write(conn, rbuf, rlen) < 0) return TLS_WANT_WRITE;
+    br_ssl_engine_sendrec_ack(&conn->sc.eng, rlen);
+  }
+
+  return written;
+}
+
+int readData(int id, unsigned char *buf, size_t len) {
+  Connection *conn = getConnection(id);
+  if (conn == NULL) return -1;
+
+  ret = runUntil(conn, BR_SSL_RECVAPP);
+  if (ret == TLS_WANT_READ) return ret;
+  if (ret != 0) {
+    if (closedCleanly(conn)) return 0;  // EOF
+    printf("read failed with error %i\n", err);
+    return -1;
+  }
+
+  size_t alen;
+  unsigned char *abuf = br_ssl_engine_recvapp_buf(&conn->sc.eng, &alen);
+  if (alen > len) alen = len;
+  memcpy(buf, abuf, alen);
+  br_ssl_engine_recvapp_ack(&conn->sc.eng, alen);
+
+  #ifdef CHATTY
+    printf("read %zu decrypted bytes\n", alen);
+  #endif
+
+  return alen;
+}
+
+#else
+
+int writeData(int id, unsigned char *buf, size_t len) {  // encrypt and send (via JS callback) data, returning len or -1
+  Connection *conn = getConnection(id);
+  if (conn == NULL) return -1;
+
   #ifdef CHATTY
     printf("writing %li unencrypted bytes:", len);
     for (int i = 0; i < len; i++) printf(" %02x", buf[i]);
     puts("");
   #endif
   
-  ret = br_sslio_write_all(&ioc, buf, len);
+  ret = br_sslio_write_all(&conn->ioc, buf, len);
   if (ret != 0) {
-    err = br_ssl_engine_last_error(&sc.eng);
+    flushEncrypted(conn);  // probably an alert
+    err = br_ssl_engine_last_error(&conn->sc.eng);
     printf("write failed with error %i\n", err);
     return ret;
   }
 
-  ret = br_sslio_flush(&ioc);
+  ret = br_sslio_flush(&conn->ioc);
+  if (ret == 0) ret = flushEncrypted(conn);
   if (ret != 0) {
-    err = br_ssl_engine_last_error(&sc.eng);
+    err = br_ssl_engine_last_error(&conn->sc.eng);
     printf("flush failed with error %i\n", err);
     return ret;
   }
 
-  return 0;
+  return len;  // all of it, as from WolfSSL
 }
 
-int readData(unsigned char *buf, size_t len) {
-  ret = br_sslio_read(&ioc, buf, len);
+int readData(int id, unsigned char *buf, size_t len) {
+  Connection *conn = getConnection(id);
+  if (conn == NULL) return -1;
+
+  ret = br_sslio_read(&conn->ioc, buf, len);
+  flushEncrypted(conn);
   if (ret == -1) {
-    err = br_ssl_engine_last_error(&sc.eng);
+    err = br_ssl_engine_last_error(&conn->sc.eng);
     printf("read failed with error %i\n", err);
     return ret;
   }
@@ -216,3 +927,228 @@ int readData(unsigned char *buf, size_t len) {
 
   return ret;
 }
+
+#endif
+
+// decrypts the next record and returns the number of plaintext bytes, which JS reads straight out of
+// BearSSL's own buffer at readDataPointer; they stay valid until the next call (which acknowledges
+// them), so don't mix this with readData on the same connection
+int readDataInPlace(int id) {
+  Connection *conn = getConnection(id);
+  if (conn == NULL) return -1;
+
+  if (conn->lent > 0) {
+    br_ssl_engine_recvapp_ack(&conn->sc.eng, conn->lent);
+    conn->lent = 0;
+  }
+
+  ret = runUntil(conn, BR_SSL_RECVAPP);
+  flushEncrypted(conn);
+  if (ret == TLS_WANT_READ) return ret;
+  if (ret != 0) {
+    if (closedCleanly(conn)) return 0;  // EOF
+    printf("read failed with error %i\n", err);
+    return -1;
+  }
+
+  br_ssl_engine_recvapp_buf(&conn->sc.eng, &conn->lent);
+
+  #ifdef CHATTY
+    printf("read %zu decrypted bytes in place\n", conn->lent);
+  #endif
+
+  return conn->lent;
+}
+
+unsigned char *readDataPointer(int id) {
+  Connection *conn = getConnection(id);
+  if (conn == NULL) return NULL;
+
+  size_t alen;
+  return br_ssl_engine_recvapp_buf(&conn->sc.eng, &alen);
+}
+
+int hasPending(int id) {  // decrypted data, or ciphertext we've read ahead of BearSSL
+  Connection *conn = getConnection(id);
+  if (conn == NULL) return 0;
+
+  // plaintext already lent out by readDataInPlace doesn't count
+  return ((br_ssl_engine_current_state(&conn->sc.eng) & BR_SSL_RECVAPP) != 0 && conn->lent == 0) ||
+    conn->input.end > conn->input.start;
+}
+
+int tlsShutdown(int id) {  // not "shutdown", which would clash with sys/socket.h in native builds
+  Connection *conn = getConnection(id);
+  if (conn == NULL) return -1;
+
+  // send close_notify, but don't wait around for the server's reply
+  br_ssl_engine_close(&conn->sc.eng);
+  while (br_ssl_engine_current_state(&conn->sc.eng) & BR_SSL_SENDREC) {
+    size_t len;
+    unsigned char *buf = br_ssl_engine_sendrec_buf(&conn->sc.eng, &len);
+    int wlen = sock_write(conn, buf, len);
+    if (wlen <= 0) return -1;
+    br_ssl_engine_sendrec_ack(&conn->sc.eng, wlen);
+  }
+  return flushEncrypted(conn);
+}
+
+// === Session resumption (TLS 1.2 session IDs: BearSSL doesn't support tickets) ===
+
+// call between tlsOpen and tlsConnect, with data previously returned by tlsGetSession
+int tlsSetSession(int id, const unsigned char *data, int len) {
+  Connection *conn = getConnection(id);
+  if (conn == NULL || len != sizeof(br_ssl_session_parameters)) return -1;
+
+  br_ssl_session_parameters params;
+  memcpy(&params, data, sizeof params);
+  br_ssl_engine_set_session_parameters(&conn->sc.eng, &params);
+
+  ret = br_ssl_client_reset(&conn->sc, conn->host, 1);
+  if (ret != 1) {
+    err = br_ssl_engine_last_error(&conn->sc.eng);
+    printf("client reset for resumption failed with error %i\n", err);
+    return -1;
+  }
+
+  conn->offeredSessionIdLen = params.session_id_len;
+  memcpy(conn->offeredSessionId, params.session_id, params.session_id_len);
+  return 0;
+}
+
+// returns the length of the serialized session, or -1 if there isn't one or it doesn't fit
+int tlsGetSession(int id, unsigned char *buf, int len) {
+  Connection *conn = getConnection(id);
+  if (conn == NULL || len < (int)sizeof(br_ssl_session_parameters)) return -1;
+
+  br_ssl_session_parameters params;
+  br_ssl_engine_get_session_parameters(&conn->sc.eng, &params);
+  if (params.session_id_len == 0) return -1;  // server doesn't support resumption
+
+  memcpy(buf, &params, sizeof params);
+  return sizeof params;
+}
+
+int tlsSessionReused(int id) {  // the server accepted our session if it echoed its id back
+  Connection *conn = getConnection(id);
+  if (conn == NULL || conn->offeredSessionIdLen == 0) return 0;
+
+  br_ssl_session_parameters params;
+  br_ssl_engine_get_session_parameters(&conn->sc.eng, &params);
+  return params.session_id_len == conn->offeredSessionIdLen &&
+    memcmp(params.session_id, conn->offeredSessionId, params.session_id_len) == 0;
+}
+
+// === ALPN (e.g. "postgresql", which PostgreSQL 17 requires for direct TLS negotiation) ===
+
+// call between tlsOpen (and any tlsSetSession) and tlsConnect, with a single protocol name to offer
+int tlsSetAlpn(int id, const char *protocol) {
+  Connection *conn = getConnection(id);
+  if (conn == NULL || strlen(protocol) >= sizeof conn->alpn) return -1;
+
+  strcpy(conn->alpn, protocol);
+  conn->alpnNames[0] = conn->alpn;
+  br_ssl_engine_set_protocol_names(&conn->sc.eng, conn->alpnNames, 1);
+
+  // the ClientHello is composed on reset, so reset again, keeping any session offered
+  ret = br_ssl_client_reset(&conn->sc, conn->host, conn->offeredSessionIdLen > 0);
+  if (ret != 1) {
+    err = br_ssl_engine_last_error(&conn->sc.eng);
+    printf("client reset for ALPN failed with error %i\n", err);
+    return -1;
+  }
+  return 0;
+}
+
+int tlsAlpnSelected(int id) {  // 1 if the server picked the protocol offered
+  Connection *conn = getConnection(id);
+  if (conn == NULL) return 0;
+
+  return br_ssl_engine_get_selected_protocol(&conn->sc.eng) != NULL;
+}
+
+// see stats.h
+TlsStats *tlsStats(int id) {
+  Connection *conn = getConnection(id);
+  if (conn == NULL) return NULL;
+
+  #ifdef STATIC_MEMORY
+    conn->stats.heapPeak = conn->arena.used;
+    conn->stats.heapAllocs = conn->arena.allocs;
+  #endif
+  return &conn->stats;
+}
+
+// the negotiated suite and version as their IANA code points, e.g. 0xCCA8 and 0x0303, or 0 before the handshake
+int tlsCipherSuite(int id) {
+  Connection *conn = getConnection(id);
+  if (conn == NULL) return 0;
+
+  br_ssl_session_parameters params;
+  br_ssl_engine_get_session_parameters(&conn->sc.eng, &params);
+  return params.cipher_suite;
+}
+
+int tlsProtocolVersion(int id) {
+  Connection *conn = getConnection(id);
+  if (conn == NULL) return 0;
+
+  return br_ssl_engine_get_version(&conn->sc.eng);
+}
+
+void tlsClose(int id) {
+  Connection *conn = getConnection(id);
+  if (conn == NULL) return;
+
+  connections[id] = NULL;
+  freeConnection(conn);
+}
+
+#ifdef NONBLOCKING
+
+// === Non-blocking, buffer-driven I/O: JS pushes and pulls ciphertext, and nothing ever suspends ===
+
+// returns a pointer to space for len bytes of ciphertext, which JS fills before calling feedEncrypted
+unsigned char *encryptedInputBuffer(int id, int len) {
+  Connection *conn = getConnection(id);
+  if (conn == NULL) return NULL;
+
+  return bufferReserve(&conn->input, len);
+}
+
+// commits len bytes written to encryptedInputBuffer; a len of 0 signals that the socket has closed
+int feedEncrypted(int id, int len) {
+  Connection *conn = getConnection(id);
+  if (conn == NULL) return -1;
+
+  if (len == 0) conn->inputClosed = 1;
+  else conn->input.end += len;
+  conn->stats.networkReads++;
+  conn->stats.networkBytes += len;
+  return 0;
+}
+
+int pendingEncrypted(int id) {
+  Connection *conn = getConnection(id);
+  if (conn == NULL) return 0;
+
+  return conn->output.end - conn->output.start;
+}
+
+unsigned char *encryptedOutputBuffer(int id) {
+  Connection *conn = getConnection(id);
+  if (conn == NULL) return NULL;
+
+  return conn->output.data + conn->output.start;
+}
+
+// marks len bytes from encryptedOutputBuffer as sent
+void takeEncrypted(int id, int len) {
+  Connection *conn = getConnection(id);
+  if (conn == NULL) return;
+
+  conn->output.start += len;
+  if (conn->output.start == conn->output.end) conn->output.start = conn->output.end = 0;
+}
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef PLATFORM_H
+#define PLATFORM_H
+
+/*
+ * The few things the TLS shims (wolfssl.c, bearssl.c) need from whatever is hosting them: either
+ * JS, via emscripten (platform_emscripten.c), or a native program such as the benchmark harness
+ * (platform_native.c). The crypto callbacks (USESUBTLECB) are WebCrypto-specific, so they stay
+ * in wolfssl.c, and exist only in the emscripten build.
+ */
+
+#include <stddef.h>
+
+#ifndef MAX_CONNECTIONS  // the static-memory builds size their pools by it: see src/arena.h
+  #define MAX_CONNECTIONS 64
+#endif
+
+// network I/O for the default (blocking) mode, which the non-blocking build doesn't use: each returns
+// the number of bytes transferred, or 0 if the connection has closed, or -1 on error; with emscripten,
+// platformRecv suspends (via ASYNCIFY) until data arrives
+int platformRecv(int id, unsigned char *buf, size_t len);
+int platformSend(int id, const unsigned char *buf, size_t len);
+
+// like platformRecv, but never waits (or suspends): returns PLATFORM_WOULD_BLOCK if nothing has arrived
+#define PLATFORM_WOULD_BLOCK -2
+int platformRecvNow(int id, unsigned char *buf, size_t len);
+
+// cryptographically secure random bytes
+void platformRandom(unsigned char *buf, size_t len);
+
+#ifndef __EMSCRIPTEN__
+  // native only: the connected socket to use for a connection id, as returned by tlsOpen
+  void platformSetSocket(int id, int fd);
+#endif
+
+#endif
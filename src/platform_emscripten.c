@@ -0,0 +1,25 @@
+#include <emscripten.h>
+
+#include "platform.h"
+
+// these route via Module (see getModule in wstls.ts) to the connection's WebSocket
+
+EM_ASYNC_JS(int, platformRecv, (int id, unsigned char *buf, size_t len), {
+  const bytesRead = await Module.provideEncryptedFromNetwork(id, buf, len);
+  return bytesRead;
+});
+
+EM_JS(int, platformRecvNow, (int id, unsigned char *buf, size_t len), {
+  const bytesRead = Module.takeEncryptedFromNetwork(id, buf, len);
+  return bytesRead;
+});
+
+EM_JS(int, platformSend, (int id, const unsigned char *buf, size_t len), {
+  const bytesWritten = Module.writeEncryptedToNetwork(id, buf, len);
+  return bytesWritten;
+});
+
+EM_JS(void, platformRandom, (unsigned char *buf, size_t len), {
+  const arr = Module.HEAPU8.subarray(buf, buf + len);
+  crypto.getRandomValues(arr);
+});
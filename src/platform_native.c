@@ -0,0 +1,51 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "platform.h"
+
+static int sockets[MAX_CONNECTIONS];
+
+void platformSetSocket(int id, int fd) {
+  if (id >= 0 && id < MAX_CONNECTIONS) sockets[id] = fd;
+}
+
+int platformRecv(int id, unsigned char *buf, size_t len) {
+  ssize_t n;
+  do n = read(sockets[id], buf, len); while (n < 0 && errno == EINTR);
+  return n < 0 ? -1 : n;
+}
+
+int platformRecvNow(int id, unsigned char *buf, size_t len) {
+  ssize_t n;
+  do n = recv(sockets[id], buf, len, MSG_DONTWAIT); while (n < 0 && errno == EINTR);
+  if (n < 0) return errno == EAGAIN || errno == EWOULDBLOCK ? PLATFORM_WOULD_BLOCK : -1;
+  return n;
+}
+
+int platformSend(int id, const unsigned char *buf, size_t len) {  // all or nothing, like WebSocket.send
+  size_t sent = 0;
+  while (sent < len) {
+    ssize_t n = write(sockets[id], buf + sent, len - sent);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return -1;
+    sent += n;
+  }
+  return len;
+}
+
+void platformRandom(unsigned char *buf, size_t len) {
+  while (len > 0) {
+    ssize_t n = getrandom(buf, len, 0);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      perror("getrandom");
+      abort();
+    }
+    buf += n;
+    len -= n;
+  }
+}
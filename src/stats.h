@@ -0,0 +1,32 @@
+#ifndef STATS_H
+#define STATS_H
+
+/*
+ * Per-connection counters, kept by both TLS shims and returned by their tlsStats(id) export. They're
+ * plain increments on paths that already cross into JS, so they're always on. wstls.ts reads the
+ * struct straight out of wasm memory (see readEngineStats there), so keep the two layouts in sync.
+ */
+
+#include <stdint.h>
+
+// WebCrypto operations (WolfSSL's crypto callbacks, and BearSSL's AES-GCM records with ./buildbear.sh subtle)
+enum {
+  STATS_AES_GCM_ENCRYPT,
+  STATS_AES_GCM_DECRYPT,
+  STATS_SHA,
+  STATS_EC_KEYGEN,
+  STATS_ECDH,
+  STATS_CRYPTO_OPS
+};
+
+typedef struct {
+  double cryptoMs[STATS_CRYPTO_OPS];  // time in each kind of WebCrypto call, by the module's clock
+  uint32_t cryptoCalls[STATS_CRYPTO_OPS];
+  uint32_t suspensions;  // ASYNCIFY suspensions: network reads plus WebCrypto calls (0 if non-blocking)
+  uint32_t networkReads;  // ciphertext handed in by JS: platformRecv calls, or feedEncrypted calls
+  uint32_t networkBytes;
+  uint32_t heapPeak;  // static-memory builds only: the most bytes the connection held at once (see src/arena.h)
+  uint32_t heapAllocs;  // ... in how many allocations
+} TlsStats;
+
+#endif
@@ -1,48 +1,270 @@
-#include <emscripten.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <wolfssl/options.h>
 #include <wolfssl/ssl.h>
+#include <wolfssl/wolfcrypt/sha256.h>  // for the root cert digest, and the crypto callbacks
+
+#include "platform.h"
+#include "stats.h"
+#include "trust_anchors_der.h"  // TAs_DER and TAs_NUM, generated from certs/roots.pem by gentrust.mjs
+
+#ifdef STATIC_MEMORY
+#include <wolfssl/wolfcrypt/memory.h>
+#include "arena.h"
+#endif
 
 #ifdef USESUBTLECB
+#include <emscripten.h>
+#include <limits.h>
 #include <wolfssl/wolfcrypt/cryptocb.h>
+#include <wolfssl/wolfcrypt/hash.h>
+#include <wolfssl/wolfcrypt/aes.h>
+#include <wolfssl/wolfcrypt/chacha20_poly1305.h>
+#include <wolfssl/wolfcrypt/ecc.h>
+#ifdef HAVE_CURVE25519
+#include <wolfssl/wolfcrypt/curve25519.h>
+#endif
 #endif
 
-WOLFSSL_CTX *ctx = NULL;
-WOLFSSL *ssl = NULL;
+#if defined(NONBLOCKING) && defined(USESUBTLECB)
+#error "the crypto callbacks are async, so they can't be used in the non-blocking build"
+#endif
+
+#if defined(USESUBTLECB) && !defined(__EMSCRIPTEN__)
+#error "the crypto callbacks use WebCrypto, so they need emscripten"
+#endif
+
+#if defined(STATIC_MEMORY) && defined(NONBLOCKING)
+#error "JS pushes ciphertext into the non-blocking build as it arrives, so its input buffer can't be fixed"
+#endif
+
+#if defined(STATIC_MEMORY) && !defined(WOLFSSL_STATIC_MEMORY)
+#error "the static-memory build needs WolfSSL configured with --enable-staticmemory (./buildwolflib.sh static)"
+#endif
+
+#ifdef LEAN_MEMORY
+    // the lean profile (./buildwolf.sh lean): we ask the server for records of at most MAX_FRAGMENT
+    // bytes (max_fragment_length, RFC 6066: 512, 1024, 2048 or 4096), and size buffers to match
+    #ifndef MAX_FRAGMENT
+        #define MAX_FRAGMENT 4096
+    #endif
+    #define RECV_BUFFER_SIZE MAX_FRAGMENT
+    #define RECV_AHEAD_SIZE (MAX_FRAGMENT + 512)  // a full record, with its header and expansion
+    #define BUFFER_MIN_CAP 1024
+#else
+    #define RECV_BUFFER_SIZE 16384  // one record's worth of plaintext
+    #define RECV_AHEAD_SIZE 32768  // ciphertext asked of JS per network read: whatever has arrived, up to this
+    #define BUFFER_MIN_CAP 16384
+#endif
+
+#ifdef STATIC_MEMORY
+    // the static-memory build (./buildwolf.sh static): WolfSSL allocates from fixed pools, and the
+    // shim from a fixed arena per connection (see arena.h), all sized for MAX_CONNECTIONS; the
+    // heapPeak stats show how much of them a connection really uses
+    #ifndef ARENA_SIZE
+        #ifdef LEAN_MEMORY
+            #define ARENA_SIZE (48 * 1024)
+        #else
+            #define ARENA_SIZE (128 * 1024)  // read-ahead, staged output, and the hash buffers
+        #endif
+    #endif
+    #ifndef POOL_PER_CONNECTION
+        #define POOL_PER_CONNECTION (96 * 1024)  // the WOLFSSL object, and the handshake's temporaries
+    #endif
+    #define POOL_SHARED (64 * 1024 + TAs_NUM * 4096)  // the context, and the trust anchors loaded into it
+    #define IO_POOL_SIZE (MAX_CONNECTIONS * 2 * (WOLFMEM_IO_SZ + 64))  // a record buffer each way, and bucket headers
+#endif
+
+// status codes returned by the non-blocking API, and by non-blocking connections (see tlsSetNonBlocking)
+#define TLS_WANT_READ -2
+#define TLS_WANT_WRITE -3
+
+typedef struct {
+    unsigned char *data;
+    size_t start;
+    size_t end;
+    size_t cap;
+    #ifdef STATIC_MEMORY
+        Arena *arena;  // what it grows into
+    #endif
+} Buffer;
+
+#ifdef USESUBTLECB
+typedef struct HashBuffer {
+    void *owner;  // the hash context whose message this is, or NULL once it's final
+    Buffer data;  // everything hashed since the last final
+    uint32_t generation;  // counts finals, for copies of the owner (see bufferedHash)
+    struct HashBuffer *next;  // the connection's other hash buffers
+} HashBuffer;
+#endif
+
+typedef struct {
+    int id;
+    WOLFSSL *ssl;
+    unsigned char recvBuf[RECV_BUFFER_SIZE];  // plaintext from readDataInPlace, read by JS straight out of the heap
+    Buffer output;  // ciphertext produced by WolfSSL, not yet taken by (or sent via) JS
+    Buffer input;  // ciphertext from JS (pushed in, or read ahead), not yet consumed by WolfSSL
+    TlsStats stats;
+    #ifdef NONBLOCKING
+        int inputClosed;
+    #else
+        int nonBlocking;  // see tlsSetNonBlocking
+    #endif
+    #ifdef USESUBTLECB
+        HashBuffer *hashBuffers;  // freed with the connection
+    #endif
+    #ifdef STATIC_MEMORY
+        Arena arena;
+        unsigned char arenaSpace[ARENA_SIZE];  // last, so that clearing a slot can skip it
+    #endif
+} Connection;
+
+// a context, with its trust anchors (the built-in ones, plus any extra root cert), is shared by all
+// connections that bring the same root cert, or none, and found by the cert's digest. The static
+// build's pools belong to a single context, so there every connection must bring the same one
+#ifdef STATIC_MEMORY
+    #define MAX_CONTEXTS 1
+#else
+    #define MAX_CONTEXTS 8
+#endif
+typedef struct {
+    WOLFSSL_CTX *ctx;
+    byte rootCertDigest[WC_SHA256_DIGEST_SIZE];  // of the PEM passed to tlsOpen, or of "" if none
+} Context;
+Context contexts[MAX_CONTEXTS];
+Connection *connections[MAX_CONNECTIONS];
+#ifdef STATIC_MEMORY
+    Connection connectionSlots[MAX_CONNECTIONS];
+    unsigned char pool[POOL_SHARED + MAX_CONNECTIONS * POOL_PER_CONNECTION];
+    unsigned char ioPool[IO_POOL_SIZE];
+#endif
+Connection *currentConnection = NULL;  // for callbacks that aren't given a context, i.e. cryptCb
 int ret;
 size_t len;
-int hasDigestStream;
 
-EM_JS(int, checkForDigestStream, (), {
-    return crypto.DigestStream === undefined ? 0 : 1;
-});
+// makes room for len more bytes at the end of the buffer, returning a pointer to that space
+unsigned char *bufferReserve(Buffer *b, size_t len) {
+    if (b->start > 0 && b->end + len > b->cap) {  // compact
+        memmove(b->data, b->data + b->start, b->end - b->start);
+        b->end -= b->start;
+        b->start = 0;
+    }
+    if (b->end + len > b->cap) {  // grow
+        size_t cap = b->cap == 0 ? BUFFER_MIN_CAP : b->cap;
+        while (cap < b->end + len) cap *= 2;
+        #ifdef STATIC_MEMORY
+            unsigned char *data = arenaRealloc(b->arena, b->data, b->cap, cap);
+        #else
+            unsigned char *data = realloc(b->data, cap);
+        #endif
+        if (data == NULL) return NULL;
+        b->data = data;
+        b->cap = cap;
+    }
+    return b->data + b->end;
+}
 
-EM_ASYNC_JS(int, jsProvideEncryptedFromNetwork, (char *buff, int sz), {
-    const bytesRead = await Module.provideEncryptedFromNetwork(buff, sz);
-    return bytesRead;
-});
+#ifdef NONBLOCKING
 
-EM_JS(int, jsWriteEncryptedToNetwork, (char *buff, int sz), {
-    const bytesWritten = Module.writeEncryptedToNetwork(buff, sz);
-    return bytesWritten;
-});
+int my_IORecv(WOLFSSL *ssl, char *buff, int sz, void *ctx) {
+    Connection *conn = (Connection *)ctx;
+    size_t avail = conn->input.end - conn->input.start;
+    if (avail == 0) return conn->inputClosed ? WOLFSSL_CBIO_ERR_CONN_CLOSE : WOLFSSL_CBIO_ERR_WANT_READ;
+
+    if (sz > avail) sz = avail;
+    memcpy(buff, conn->input.data + conn->input.start, sz);
+    conn->input.start += sz;
+    return sz;
+}
+
+int my_IOSend(WOLFSSL *ssl, char *buff, int sz, void *ctx) {
+    Connection *conn = (Connection *)ctx;
+    unsigned char *space = bufferReserve(&conn->output, sz);
+    if (space == NULL) return WOLFSSL_CBIO_ERR_WANT_WRITE;
+
+    memcpy(space, buff, sz);
+    conn->output.end += sz;
+    return sz;
+}
+
+int flushEncrypted(Connection *conn) {  // nothing to do: JS takes the output buffer after every call
+    return 0;
+}
+
+#else
+
+// ciphertext is staged in the output buffer and handed over in one piece, rather than record by
+// record, at the end of each call and before we wait for the server
+int flushEncrypted(Connection *conn) {
+    size_t len = conn->output.end - conn->output.start;
+    if (len == 0) return 0;
+
+    #ifdef CHATTY
+        printf("sending %zu staged bytes to JS\n", len);
+    #endif
+
+    int sent = platformSend(conn->id, conn->output.data + conn->output.start, len);
+    conn->output.start = conn->output.end = 0;
+    return sent < 0 ? -1 : 0;
+}
+
+// refills the (empty) input buffer with everything JS has queued, up to RECV_AHEAD_SIZE, suspending
+// only if nothing has arrived (or, if the connection is non-blocking, returning PLATFORM_WOULD_BLOCK):
+// WolfSSL reads each record's header and body separately, and this way those reads, and any further
+// records that came in the same message, are served from memory
+int fillInput(Connection *conn) {
+    if (flushEncrypted(conn) < 0) return -1;
+
+    conn->input.start = conn->input.end = 0;
+    unsigned char *space = bufferReserve(&conn->input, RECV_AHEAD_SIZE);
+    if (space == NULL) return -1;
+
+    int recvd = platformRecvNow(conn->id, space, RECV_AHEAD_SIZE);
+    if (recvd == PLATFORM_WOULD_BLOCK) {
+        if (conn->nonBlocking) return recvd;
+        recvd = platformRecv(conn->id, space, RECV_AHEAD_SIZE);
+        #ifdef __EMSCRIPTEN__
+            conn->stats.suspensions++;
+        #endif
+    }
+    conn->stats.networkReads++;
+    if (recvd > 0) {
+        conn->stats.networkBytes += recvd;
+        conn->input.end += recvd;
+    }
+
+    #ifdef CHATTY
+        printf("received %d bytes from JS\n\n", recvd);
+    #endif
+
+    return recvd;
+}
 
 int my_IORecv(WOLFSSL *ssl, char *buff, int sz, void *ctx) {
-    int recvd = jsProvideEncryptedFromNetwork(buff, sz);
-    if (recvd == -1) {
-        fprintf(stderr, "General error\n");
-        return WOLFSSL_CBIO_ERR_GENERAL;
+    Connection *conn = (Connection *)ctx;
+    if (conn->input.end == conn->input.start) {
+        int recvd = fillInput(conn);
+        if (recvd == PLATFORM_WOULD_BLOCK) return WOLFSSL_CBIO_ERR_WANT_READ;
+        if (recvd == 0) return WOLFSSL_CBIO_ERR_CONN_CLOSE;
+        if (recvd < 0) {
+            fprintf(stderr, "General error\n");
+            return WOLFSSL_CBIO_ERR_GENERAL;
+        }
     }
-    if (recvd == 0) return WOLFSSL_CBIO_ERR_CONN_CLOSE;
+
+    size_t avail = conn->input.end - conn->input.start;
+    if (sz > avail) sz = avail;
+    memcpy(buff, conn->input.data + conn->input.start, sz);
+    conn->input.start += sz;
 
     #ifdef CHATTY
         printf("%s", "recv:");
         for (int i = 0; i < sz; i++) printf(" %02x", (byte)buff[i]);
         puts("");
-        printf("received %d bytes from JS\n\n", recvd);
     #endif
-    
-    return recvd;
+
+    return sz;
 }
 
 int my_IOSend(WOLFSSL *ssl, char *buff, int sz, void *ctx) {
@@ -52,51 +274,547 @@ int my_IOSend(WOLFSSL *ssl, char *buff, int sz, void *ctx) {
         puts("");
     #endif
 
-    int sent = jsWriteEncryptedToNetwork(buff, sz);
+    Connection *conn = (Connection *)ctx;
+    unsigned char *space = bufferReserve(&conn->output, sz);
+    #ifdef STATIC_MEMORY
+        if (space == NULL && flushEncrypted(conn) == 0) space = bufferReserve(&conn->output, sz);  // the arena is full
+    #endif
+    if (space == NULL) return WOLFSSL_CBIO_ERR_GENERAL;
+
+    memcpy(space, buff, sz);
+    conn->output.end += sz;
+    return sz;
+}
+
+#endif
+
+#ifdef USESUBTLECB
+
+// every WebCrypto call suspends, so each is counted and timed against the current connection
+void countCrypto(int op, double started) {
+    if (currentConnection == NULL) return;
+    TlsStats *stats = &currentConnection->stats;
+    stats->cryptoMs[op] += emscripten_get_now() - started;
+    stats->cryptoCalls[op]++;
+    stats->suspensions++;
+}
+
+// a WebCrypto call costs a suspension and a round trip through JS whatever its size, so short
+// AES-GCM records and hash messages are done in wasm instead. The thresholds (and the suite order
+// that goes with them) are measured by tlsCalibrate, once per module instance, or pinned from JS
+// via tlsCryptoPolicy; these defaults stand when the clock doesn't move, as in Workers.
+#define AES_OFFLOAD_THRESHOLD 1024  // bytes
+#define SHA_OFFLOAD_THRESHOLD 4096
+
+typedef struct {  // read and written by wstls.ts (see CryptoPolicy there), so keep the two in sync
+    int32_t aesOffloadThreshold;  // AES-GCM records at least this long go to WebCrypto (INT_MAX: none)
+    int32_t shaOffloadThreshold;  // likewise, whole messages to be hashed
+    int32_t preferChaCha;  // offer ChaCha20-Poly1305 (always in wasm) ahead of AES-GCM
+    int32_t calibrated;  // set by tlsCalibrate, when it could measure
+} CryptoPolicy;
+
+CryptoPolicy policy = { AES_OFFLOAD_THRESHOLD, SHA_OFFLOAD_THRESHOLD, 0, 0 };
+
+CryptoPolicy *tlsCryptoPolicy(void) {
+    return &policy;
+}
+
+// hash updates are buffered in wasm memory, per hash context, and nothing crosses into JS until the
+// digest is wanted: then a short message is hashed right here by WolfSSL's own code, and a long one
+// goes to WebCrypto in one piece. So there's at most one suspension per digest, rather than one per
+// update, and none at all for the many small HKDF/HMAC digests in a handshake.
 
+EM_ASYNC_JS(void, jsSha, (int shaVersion, const byte *data, int sz, byte *digest), {
     #ifdef CHATTY
-        printf("sent %d bytes to JS\n", sz);
+        console.log('crypto.subtle SHAx', shaVersion, data, sz, digest);
     #endif
+    const arrData = Module.HEAPU8.subarray(data, data + sz);  // copied by digest() before it returns
+    const arrDigest = new Uint8Array(await crypto.subtle.digest(`SHA-${shaVersion}`, arrData));
+    Module.HEAPU8.set(arrDigest, digest);
+});
+
+// the buffer for a hash context is found via the context's devCtx field. WolfSSL's own length fields
+// go unused while the callback does the hashing, so they hold how much of the buffer is the context's
+// message, and which use of the buffer that is. wc_Sha*Copy copies them along with devCtx, so a copy
+// (as made for each TLS 1.3 transcript hash) sees the message as it was when it was copied, however
+// far the original has gone on since, and gets a buffer of its own when it's first updated.
+typedef struct {
+    void **devCtx;
+    word32 *len;  // buffLen
+    word32 *generation;  // loLen (its low half, for SHA-384/512)
+} HashFields;
+
+static HashFields hashFields(wc_CryptoInfo *info) {
+    switch (info->hash.type) {
+        case WC_HASH_TYPE_SHA:
+            return (HashFields){ &info->hash.sha1->devCtx, &info->hash.sha1->buffLen, &info->hash.sha1->loLen };
+        case WC_HASH_TYPE_SHA256:
+            return (HashFields){ &info->hash.sha256->devCtx, &info->hash.sha256->buffLen, &info->hash.sha256->loLen };
+        case WC_HASH_TYPE_SHA384:
+            return (HashFields){ &info->hash.sha384->devCtx, &info->hash.sha384->buffLen, (word32 *)&info->hash.sha384->loLen };
+        default:
+            return (HashFields){ &info->hash.sha512->devCtx, &info->hash.sha512->buffLen, (word32 *)&info->hash.sha512->loLen };
+    }
+}
+
+// a finished buffer of the connection's, or else a new one. A finished buffer isn't freed, since a
+// copy may still point at it, but it's reused: so there are only as many as there are messages
+// being hashed at once (dozens of short HMAC messages per handshake, but few at a time)
+static HashBuffer *takeHashBuffer(void *owner) {
+    if (currentConnection == NULL) return NULL;
 
-    return sent;
+    HashBuffer *hb = currentConnection->hashBuffers;
+    while (hb != NULL && hb->owner != NULL) hb = hb->next;
+    if (hb == NULL) {
+        #ifdef STATIC_MEMORY
+            hb = arenaAlloc(&currentConnection->arena, sizeof(HashBuffer));
+            if (hb == NULL) return NULL;
+            memset(hb, 0, sizeof(HashBuffer));
+            hb->data.arena = &currentConnection->arena;
+        #else
+            hb = calloc(1, sizeof(HashBuffer));
+            if (hb == NULL) return NULL;
+        #endif
+        hb->next = currentConnection->hashBuffers;
+        currentConnection->hashBuffers = hb;
+    }
+    hb->owner = owner;
+    return hb;
+}
+
+// after its owner's final: a copy that still points here sees the new generation, and knows that
+// its message has gone
+static void releaseHashBuffer(HashBuffer *hb) {
+    hb->owner = NULL;
+    hb->generation++;
+    hb->data.start = hb->data.end = 0;
+    #ifndef STATIC_MEMORY  // otherwise the space is kept for reuse, as it can't go back to the arena
+        free(hb->data.data);
+        hb->data.data = NULL;
+        hb->data.cap = 0;
+    #endif
 }
 
-void cleanup() {
-    if (ssl) {
-        wolfSSL_free(ssl);
-        ssl = NULL;
+int bufferedHash(wc_CryptoInfo *info) {
+    void *hashCtx = info->hash.sha256;  // a union, so this is the context whatever the hash type
+    HashFields f = hashFields(info);
+    HashBuffer *hb = (HashBuffer *)*f.devCtx;
+    if (hb != NULL && hb->owner != hashCtx && hb->generation != *f.generation) {
+        return BAD_STATE_E;  // a copy of a message that has since been finished
     }
-    if (ctx) {
-        wolfSSL_CTX_free(ctx);
-        ctx = NULL;
+
+    if (info->hash.digest == NULL) {  // update
+        if (hb == NULL && (*f.len != 0 || *f.generation != 0)) {
+            return CRYPTOCB_UNAVAILABLE;  // WolfSSL started this message itself, so it carries on
+        }
+        if (hb == NULL || hb->owner != hashCtx) {
+            HashBuffer *own = takeHashBuffer(hashCtx);
+            if (own == NULL) return hb == NULL ? CRYPTOCB_UNAVAILABLE : MEMORY_E;
+            if (hb != NULL && *f.len > 0) {  // a copy: its message so far is a prefix of the original's
+                unsigned char *space = bufferReserve(&own->data, *f.len);
+                if (space == NULL) return MEMORY_E;
+                memcpy(space, hb->data.data + hb->data.start, *f.len);
+                own->data.end += *f.len;
+            }
+            hb = own;
+            *f.devCtx = hb;
+            *f.generation = hb->generation;
+        }
+        unsigned char *space = bufferReserve(&hb->data, info->hash.inSz);
+        if (info->hash.inSz > 0 && space == NULL) return MEMORY_E;
+        if (info->hash.inSz > 0) memcpy(space, info->hash.in, info->hash.inSz);
+        hb->data.end += info->hash.inSz;
+        *f.len = hb->data.end - hb->data.start;
+        return 0;
     }
-    wolfSSL_Cleanup();
+
+    // final: with no buffer, the context was never updated here, so WolfSSL can finish it itself
+    if (hb == NULL) return CRYPTOCB_UNAVAILABLE;
+
+    const byte *data = hb->data.data + hb->data.start;
+    size_t len = *f.len;  // for a copy not updated since, the original's message as it was then
+    int result = 0;
+    if (len < policy.shaOffloadThreshold) {
+        result = wc_Hash((enum wc_HashType)info->hash.type, data, len, info->hash.digest,
+            wc_HashGetDigestSize((enum wc_HashType)info->hash.type));  // this doesn't use the callback
+    } else {
+        int shaVersion =
+            info->hash.type == WC_HASH_TYPE_SHA256 ? 256 :
+            info->hash.type == WC_HASH_TYPE_SHA384 ? 384 :
+            info->hash.type == WC_HASH_TYPE_SHA512 ? 512 : 1;
+        double started = emscripten_get_now();
+        jsSha(shaVersion, data, len, info->hash.digest);
+        countCrypto(STATS_SHA, started);
+    }
+
+    // like a software final, this leaves the context ready for a new message, in a new buffer
+    if (hb->owner == hashCtx) releaseHashBuffer(hb);
+    *f.devCtx = NULL;
+    *f.len = *f.generation = 0;
+    return result;
+}
+
+// ECDHE key generation and agreement are the costliest part of a handshake in (-Oz) wasm, and
+// WebCrypto does them natively. Keys are made in JS and imported into WolfSSL's key structs, so that
+// WolfSSL can encode our key share as usual, and the private key goes back to JS for the agreement.
+// A curve the runtime doesn't support is noted and left to WolfSSL from then on.
+//
+// Certificate and CertificateVerify signatures stay in wasm: the callback is given only the digest
+// for ECDSA verification, and only a raw public key operation for RSA, neither of which WebCrypto
+// can take. HMAC (i.e. HKDF) stays too: its inputs are tens of bytes, so the key import and the
+// suspension would cost more than the hashing, which bufferedHash above keeps in wasm anyway.
+#define EC_X25519 0  // passed as the curve size in bits for the NIST curves
+
+unsigned int ecUnsupported;  // a bit per curve, see ecBit
+
+int ecBit(int bits) {
+    return bits == EC_X25519 ? 1 : bits == 256 ? 2 : bits == 384 ? 4 : 8;
 }
 
-EM_ASYNC_JS(void, jsSha, (int shaVersion, const byte *buffDataIn, int sz, byte *buffDigest), {
+// returns 0, or -1 on failure, or -2 if the runtime doesn't support the curve
+EM_ASYNC_JS(int, jsEcGenerateKey, (int bits, byte *d, byte *x, byte *y, int size), {
     #ifdef CHATTY
-        console.log('crypto.subtle SHAx', shaVersion, buffDataIn, sz, buffDigest);
+        console.log('crypto.subtle EC keygen', bits);
     #endif
-    if (buffDataIn !== 0) {  // writing data
-        if (Module._digestStream == null) {  // deliberate loose equality
-            const stream = new crypto.DigestStream(`SHA-${shaVersion}`);
-            const writer = stream.getWriter();
-            Module._digestStream = { stream, writer };
+    const fromBase64Url = s => Uint8Array.from(atob(s.replaceAll('-', '+').replaceAll('_', '/')), c => c.charCodeAt(0));
+    try {
+        const alg = bits === 0 ? { name: 'X25519' } : { name: 'ECDH', namedCurve: `P-${bits}` };
+        const { privateKey } = await crypto.subtle.generateKey(alg, true, ['deriveBits']);
+        const jwk = await crypto.subtle.exportKey('jwk', privateKey);
+        Module.HEAPU8.set(fromBase64Url(jwk.d), d);
+        Module.HEAPU8.set(fromBase64Url(jwk.x), x);
+        if (y !== 0) Module.HEAPU8.set(fromBase64Url(jwk.y), y);
+        return 0;
+    } catch (err) {
+        return err.name === 'NotSupportedError' ? -2 : -1;
+    }
+});
+
+// returns the length of the shared secret written to out, or -1 or -2 as for jsEcGenerateKey
+EM_ASYNC_JS(int, jsEcdh, (int bits, const byte *d, const byte *x, const byte *y, const byte *peer, int peerLen, int size, byte *out), {
+    #ifdef CHATTY
+        console.log('crypto.subtle ECDH', bits);
+    #endif
+    const toBase64Url = (p, len) => btoa(String.fromCharCode(...Module.HEAPU8.subarray(p, p + len)))
+        .replaceAll('+', '-').replaceAll('/', '_').replaceAll('=', '');
+    try {
+        const alg = bits === 0 ? { name: 'X25519' } : { name: 'ECDH', namedCurve: `P-${bits}` };
+        const jwk = bits === 0 ?
+            { kty: 'OKP', crv: 'X25519', d: toBase64Url(d, size), x: toBase64Url(x, size) } :
+            { kty: 'EC', crv: `P-${bits}`, d: toBase64Url(d, size), x: toBase64Url(x, size), y: toBase64Url(y, size) };
+        const privateKey = await crypto.subtle.importKey('jwk', jwk, alg, false, ['deriveBits']);
+        const publicKey = await crypto.subtle.importKey('raw', Module.HEAPU8.slice(peer, peer + peerLen), alg, false, []);
+        const secret = new Uint8Array(await crypto.subtle.deriveBits({ name: alg.name, public: publicKey }, privateKey, size * 8));
+        Module.HEAPU8.set(secret, out);
+        return secret.length;
+    } catch (err) {
+        return err.name === 'NotSupportedError' ? -2 : -1;
+    }
+});
+
+int eccBits(int curveId, int size) {
+    if (curveId == ECC_CURVE_DEF) return size == 32 ? 256 : size == 48 ? 384 : size == 66 ? 521 : -1;
+    return curveId == ECC_SECP256R1 ? 256 : curveId == ECC_SECP384R1 ? 384 : curveId == ECC_SECP521R1 ? 521 : -1;
+}
+
+int offloadEccKeygen(wc_CryptoInfo *info) {
+    int size = info->pk.eckg.size;
+    int bits = eccBits(info->pk.eckg.curveId, size);
+    if (bits < 0 || (ecUnsupported & ecBit(bits))) return CRYPTOCB_UNAVAILABLE;
+
+    byte d[MAX_ECC_BYTES], x[MAX_ECC_BYTES], y[MAX_ECC_BYTES];
+    double started = emscripten_get_now();
+    int result = jsEcGenerateKey(bits, d, x, y, size);
+    countCrypto(STATS_EC_KEYGEN, started);
+    if (result == -2) ecUnsupported |= ecBit(bits);
+    if (result < 0) return CRYPTOCB_UNAVAILABLE;
+
+    int curveId = bits == 256 ? ECC_SECP256R1 : bits == 384 ? ECC_SECP384R1 : ECC_SECP521R1;
+    result = wc_ecc_import_unsigned(info->pk.eckg.key, x, y, d, curveId);
+    memset(d, 0, sizeof d);
+    return result;
+}
+
+int offloadEcdh(wc_CryptoInfo *info) {
+    ecc_key *key = info->pk.ecdh.private_key;
+    if (key->dp == NULL) return CRYPTOCB_UNAVAILABLE;
+    int size = key->dp->size;
+    int bits = eccBits(key->dp->id, size);
+    if (bits < 0 || (ecUnsupported & ecBit(bits))) return CRYPTOCB_UNAVAILABLE;
+    if (*info->pk.ecdh.outlen < (word32)size) return BUFFER_E;
+
+    byte d[MAX_ECC_BYTES], x[MAX_ECC_BYTES], y[MAX_ECC_BYTES], peer[1 + 2 * MAX_ECC_BYTES];
+    word32 dLen = size, xLen = size, yLen = size, peerLen = sizeof peer;
+    if (wc_ecc_export_private_raw(key, x, &xLen, y, &yLen, d, &dLen) != 0 ||
+        wc_ecc_export_x963(info->pk.ecdh.public_key, peer, &peerLen) != 0) return CRYPTOCB_UNAVAILABLE;
+
+    double started = emscripten_get_now();
+    int len = jsEcdh(bits, d, x, y, peer, peerLen, size, info->pk.ecdh.out);
+    countCrypto(STATS_ECDH, started);
+    memset(d, 0, sizeof d);
+    if (len == -2) ecUnsupported |= ecBit(bits);
+    if (len < 0) return CRYPTOCB_UNAVAILABLE;  // WolfSSL will try, and report any problem with the peer's key
+
+    *info->pk.ecdh.outlen = len;
+    return 0;
+}
+
+#ifdef HAVE_CURVE25519
+int offloadX25519Keygen(wc_CryptoInfo *info) {
+    if (ecUnsupported & ecBit(EC_X25519)) return CRYPTOCB_UNAVAILABLE;
+
+    byte d[CURVE25519_KEYSIZE], x[CURVE25519_KEYSIZE];
+    double started = emscripten_get_now();
+    int result = jsEcGenerateKey(EC_X25519, d, x, NULL, CURVE25519_KEYSIZE);
+    countCrypto(STATS_EC_KEYGEN, started);
+    if (result == -2) ecUnsupported |= ecBit(EC_X25519);
+    if (result < 0) return CRYPTOCB_UNAVAILABLE;
+
+    // clamping doesn't change the results of X25519, but WolfSSL expects it of a private key
+    d[0] &= 248;
+    d[31] &= 127;
+    d[31] |= 64;
+    result = wc_curve25519_import_private_raw_ex(d, sizeof d, x, sizeof x, info->pk.curve25519kg.key, EC25519_LITTLE_ENDIAN);
+    memset(d, 0, sizeof d);
+    return result;
+}
+
+int offloadX25519(wc_CryptoInfo *info) {
+    if (ecUnsupported & ecBit(EC_X25519)) return CRYPTOCB_UNAVAILABLE;
+    if (*info->pk.curve25519.outlen < CURVE25519_KEYSIZE) return BUFFER_E;
+
+    byte d[CURVE25519_KEYSIZE], x[CURVE25519_KEYSIZE], peer[CURVE25519_KEYSIZE];
+    word32 dLen = sizeof d, xLen = sizeof x, peerLen = sizeof peer;
+    if (wc_curve25519_export_private_raw_ex(info->pk.curve25519.private_key, d, &dLen, EC25519_LITTLE_ENDIAN) != 0 ||
+        wc_curve25519_export_public_ex(info->pk.curve25519.private_key, x, &xLen, EC25519_LITTLE_ENDIAN) != 0 ||
+        wc_curve25519_export_public_ex(info->pk.curve25519.public_key, peer, &peerLen, EC25519_LITTLE_ENDIAN) != 0) {
+        return CRYPTOCB_UNAVAILABLE;
+    }
+
+    byte *out = info->pk.curve25519.out;
+    double started = emscripten_get_now();
+    int len = jsEcdh(EC_X25519, d, x, NULL, peer, peerLen, CURVE25519_KEYSIZE, out);
+    countCrypto(STATS_ECDH, started);
+    memset(d, 0, sizeof d);
+    if (len == -2) ecUnsupported |= ecBit(EC_X25519);
+    if (len < 0) return CRYPTOCB_UNAVAILABLE;
+
+    if (info->pk.curve25519.endian == EC25519_BIG_ENDIAN) {  // WebCrypto's output is little-endian
+        for (int i = 0; i < len / 2; i++) {
+            byte b = out[i];
+            out[i] = out[len - 1 - i];
+            out[len - 1 - i] = b;
+        }
+    }
+    *info->pk.curve25519.outlen = len;
+    return 0;
+}
+#endif
+
+// AES keys only change on handshake or KeyUpdate, so we import each one into WebCrypto once and
+// cache it per connection, keyed by the address of its Aes struct and checked against the raw key.
+// Called by tlsCalibrate, or else initContext, whichever comes first.
+EM_JS(void, jsInitAesKeyCache, (const CryptoPolicy *policyPtr), {
+    if (Module.aesKeyCache !== undefined) return;
+    Module.aesOffloadThreshold = () => new Int32Array(Module.HEAPU8.buffer, policyPtr, 1)[0];  // see CryptoPolicy
+    Module.aesKeyCache = new Map();  // connection id -> Map(Aes address -> key entry)
+    Module.aesKeyStats = new Map();  // connection id -> { imports, reuses, readAheadHits, readAheadMisses }
+
+    // the entry's key is a promise, so that read-ahead can find the entry for a record that stays in
+    // wasm without waiting for the import (see jsReadAheadSkip)
+    Module.aesGcmKeyEntrySync = (connId, aes, keyData) => {
+        let keys = Module.aesKeyCache.get(connId);
+        let stats = Module.aesKeyStats.get(connId);
+        if (keys === undefined) {
+            Module.aesKeyCache.set(connId, keys = new Map());
+            Module.aesKeyStats.set(connId, stats = { imports: 0, reuses: 0, readAheadHits: 0, readAheadMisses: 0 });
+        }
+
+        const cached = keys.get(aes);
+        if (cached !== undefined && cached.keyData.length === keyData.length &&
+            cached.keyData.every((b, i) => b === keyData[i])) {
+            stats.reuses++;
+            return cached;
+        }
+
+        keyData = keyData.slice();  // a view of the heap, which may grow before the import reads it
+        const key = crypto.subtle.importKey('raw', keyData, { name: 'AES-GCM' }, false, ['encrypt', 'decrypt']);
+        // seq, iv and speculative are used only for decryption with read-ahead (see below)
+        const entry = { keyData, key, seq: 0, iv: null, speculative: new Map() };
+        keys.set(aes, entry);
+        stats.imports++;
+        return entry;
+    };
+
+    Module.aesGcmKey = (connId, aes, keyData) => Module.aesGcmKeyEntrySync(connId, aes, keyData).key;
+
+    /*
+     * Read-ahead: when enabled for a connection, every complete TLS 1.3 record that arrives on the
+     * socket is decrypted speculatively, in parallel, as soon as we know which key and sequence
+     * number it will use. WolfSSL still asks for each record in turn via cryptCb, but by then the
+     * plaintext is usually waiting. In TLS 1.3 the AAD is the record header and the nonce is the
+     * static IV XOR the sequence number, which restarts at 0 with each new key, so the first nonce
+     * we see for a key is its static IV. A wrong guess (e.g. after a KeyUpdate) just fails, and we
+     * then decrypt normally.
+     */
+    Module.readAheadState = new Map();  // connection id -> { records, partial, entry, aligned }
+    Module.readAheadLimit = 64;  // max records decrypted ahead
+
+    Module.readAheadStart = (connId) => {
+        Module.readAheadState.set(connId, { records: [], partial: null, entry: null, aligned: false });
+    };
+
+    Module.readAheadChunk = (connId, data) => {
+        const state = Module.readAheadState.get(connId);
+        if (state === undefined) return;
+
+        if (state.partial !== null) {
+            const joined = new Uint8Array(state.partial.length + data.length);
+            joined.set(state.partial);
+            joined.set(data, state.partial.length);
+            data = joined;
+            state.partial = null;
+        }
+        let offset = 0;
+        while (data.length - offset >= 5) {
+            const end = offset + 5 + ((data[offset + 3] << 8) | data[offset + 4]);
+            if (end > data.length) break;
+            if (data[offset] === 23) state.records.push({  // application_data: i.e. encrypted
+                header: data.subarray(offset, offset + 5),
+                body: data.subarray(offset + 5, end),
+            });
+            offset = end;
+        }
+        if (offset < data.length) state.partial = data.slice(offset);
+
+        Module.readAheadSpeculate(state);
+    };
+
+    Module.readAheadSpeculate = (state) => {
+        const entry = state.entry;
+        if (!state.aligned || entry === null) return;
+
+        const n = Math.min(state.records.length, Module.readAheadLimit);
+        const threshold = Module.aesOffloadThreshold() + 16;  // shorter records will stay in wasm (see cryptCb)
+        for (let i = 0; i < n; i++) {
+            const seq = entry.seq + i;
+            if (entry.speculative.has(seq)) continue;
+
+            const { header, body } = state.records[i];
+            if (body.length < threshold) continue;
+            const nonce = Module.gcmNonce(entry.iv, seq);
+            const algorithm = { name: 'AES-GCM', iv: nonce, tagLength: 128, additionalData: header };
+            const promise = entry.key.then(key => crypto.subtle.decrypt(algorithm, key, body)).then(
+                result => new Uint8Array(result),
+                () => null
+            );
+            entry.speculative.set(seq, { header, body, nonce, promise });
+        }
+    };
+
+    Module.gcmNonce = (staticIv, seq) => {
+        const nonce = staticIv.slice();
+        for (let i = nonce.length - 1; seq > 0; i--) {
+            nonce[i] ^= seq & 0xff;
+            seq = Math.floor(seq / 256);
+        }
+        return nonce;
+    };
+
+    Module.bytesEqual = (a, b) => a.length === b.length && a.every((x, i) => x === b[i]);
+
+    Module.tagMatches = (body, authTag) => {
+        const offset = body.length - authTag.length;
+        return offset >= 0 && authTag.every((b, i) => b === body[offset + i]);
+    };
+
+    // moves read-ahead on past this record, which WolfSSL is decrypting (or about to), returning
+    // what was decrypted ahead for it, if anything; the record is here if it's TLS 1.3
+    Module.readAheadTrack = (state, entry, iv, additionalData, authTag, recordLength) => {
+        if (entry.iv === null) entry.iv = iv.slice();
+        const seq = entry.seq++;
+        state.entry = entry;
+
+        const nonce = Module.gcmNonce(entry.iv, seq);
+        if (!Module.bytesEqual(nonce, iv)) {  // our assumptions don't hold: give up on this key
+            state.aligned = false;
+            entry.speculative.clear();
+            return null;
+        }
+
+        // find this record among those we've seen, and forget it and everything before it
+        const index = state.records.findIndex(r => r.body.length === recordLength &&
+            Module.bytesEqual(r.header, additionalData) && Module.tagMatches(r.body, authTag));
+        if (index >= 0) state.records.splice(0, index + 1);
+        state.aligned = index >= 0;
+
+        const speculative = entry.speculative.get(seq);
+        for (const s of entry.speculative.keys()) if (s <= seq) entry.speculative.delete(s);
+        Module.readAheadSpeculate(state);
+
+        // the same record under the same nonce and AAD, or it's not plaintext for this one
+        if (speculative === undefined || speculative.body.length !== recordLength ||
+            !Module.bytesEqual(speculative.nonce, iv) || !Module.bytesEqual(speculative.header, additionalData) ||
+            !Module.tagMatches(speculative.body, authTag)) return null;
+        return speculative;
+    };
+
+    // returns speculatively-decrypted plaintext for this record, if we have it, else null
+    Module.readAheadDecrypt = async (connId, entry, iv, additionalData, data, authTag) => {
+        const state = Module.readAheadState.get(connId);
+        if (state === undefined || additionalData.length !== 5 || authTag.length !== 16) return null;  // not TLS 1.3
+
+        const speculative = Module.readAheadTrack(state, entry, iv, additionalData, authTag, data.length + authTag.length);
+        const stats = Module.aesKeyStats.get(connId);
+        if (speculative === null) {
+            stats.readAheadMisses++;
+            return null;
+        }
+        const plainText = await speculative.promise;
+        if (plainText === null) {
+            stats.readAheadMisses++;
+            return null;
         }
-        const arrDataIn = Module.HEAPU8.subarray(buffDataIn, buffDataIn + sz);
-        await Module._digestStream.writer.write(arrDataIn);
-
-    } else {  // getting digest
-        const { stream, writer } = Module._digestStream;
-        await writer.close();
-        const digest = await stream.digest;
-        const arrDigest = new Uint8Array(digest);
-        Module.HEAPU8.set(arrDigest, buffDigest);
-        Module._digestStream = null;
-    } 
+        stats.readAheadHits++;
+        return plainText;
+    };
+});
+
+EM_JS(void, jsForgetAesKeys, (int connId), {
+    Module.aesKeyCache.delete(connId);
+    Module.aesKeyStats.delete(connId);
+    Module.readAheadState.delete(connId);
+});
+
+// read-ahead counts every record decrypted with a key to track its sequence number, so a record short
+// enough to stay in wasm (see cryptCb) is counted here, without a suspension
+EM_JS(void, jsReadAheadSkip, (
+        int connId,
+        const void *aes,
+        const byte *keyBuff,
+        int keySize,
+        const byte *ivBuff,
+        int ivSz,
+        const byte *authInBuff,
+        int authInSz,
+        const byte *authTagBuff,
+        int authTagSz,
+        int dataSz
+    ), {
+    const state = Module.readAheadState.get(connId);
+    if (state === undefined || authInSz !== 5 || authTagSz !== 16) return;  // not TLS 1.3
+
+    const entry = Module.aesGcmKeyEntrySync(connId, aes, Module.HEAPU8.subarray(keyBuff, keyBuff + keySize));
+    Module.readAheadTrack(state, entry,
+        Module.HEAPU8.slice(ivBuff, ivBuff + ivSz),
+        Module.HEAPU8.slice(authInBuff, authInBuff + authInSz),
+        Module.HEAPU8.slice(authTagBuff, authTagBuff + authTagSz),
+        dataSz + authTagSz);
 });
 
 EM_ASYNC_JS(void, jsAesGcmEncrypt, (
+        int connId,
+        const void *aes,
         const byte *dataBuff, 
         int dataSz, 
         const byte *keyBuff, 
@@ -113,15 +831,16 @@ EM_ASYNC_JS(void, jsAesGcmEncrypt, (
         console.log('crypto.subtle encrypt');
     #endif
 
-    const iv = Module.HEAPU8.subarray(ivBuff, ivBuff + ivSz);
+    // copied before the first await: memory growth would detach views of the heap
+    const iv = Module.HEAPU8.slice(ivBuff, ivBuff + ivSz);
     const tagLength = authTagSz << 3;  // WolfSSL uses bytes, JS uses bits
-    const additionalData = Module.HEAPU8.subarray(authInBuff, authInBuff + authInSz);
+    const additionalData = Module.HEAPU8.slice(authInBuff, authInBuff + authInSz);
     const algorithm = { name: 'AES-GCM', iv, tagLength, additionalData };
+    const data = Module.HEAPU8.slice(dataBuff, dataBuff + dataSz);
 
-    const keyData = Module.HEAPU8.subarray(keyBuff, keyBuff + keySize);
-    const key = await crypto.subtle.importKey('raw', keyData, { name: 'AES-GCM' }, false, ['encrypt']);
+    const keyData = Module.HEAPU8.subarray(keyBuff, keyBuff + keySize);  // copied if it's imported
+    const key = await Module.aesGcmKey(connId, aes, keyData);
 
-    const data = Module.HEAPU8.subarray(dataBuff, dataBuff + dataSz);
     const resultArrBuff = await crypto.subtle.encrypt(algorithm, key, data);
 
     const result = new Uint8Array(resultArrBuff);
@@ -132,6 +851,8 @@ EM_ASYNC_JS(void, jsAesGcmEncrypt, (
 });
 
 EM_ASYNC_JS(int, jsAesGcmDecrypt, (
+        int connId,
+        const void *aes,
         const byte *dataBuff, 
         int dataSz, 
         const byte *keyBuff, 
@@ -148,16 +869,24 @@ EM_ASYNC_JS(int, jsAesGcmDecrypt, (
         console.log('crypto.subtle decrypt');
     #endif
 
-    const iv = Module.HEAPU8.subarray(ivBuff, ivBuff + ivSz);
+    // copied before the first await: memory growth would detach views of the heap
+    const iv = Module.HEAPU8.slice(ivBuff, ivBuff + ivSz);
     const tagLength = authTagSz << 3;  // WolfSSL uses bytes, JS uses bits
-    const additionalData = Module.HEAPU8.subarray(authInBuff, authInBuff + authInSz);
+    const additionalData = Module.HEAPU8.slice(authInBuff, authInBuff + authInSz);
     const algorithm = { name: 'AES-GCM', iv, tagLength, additionalData };
+    const data = Module.HEAPU8.slice(dataBuff, dataBuff + dataSz);
+    const authTag = Module.HEAPU8.slice(authTagBuff, authTagBuff + authTagSz);
 
-    const keyData = Module.HEAPU8.subarray(keyBuff, keyBuff + keySize);
-    const key = await crypto.subtle.importKey('raw', keyData, { name: 'AES-GCM' }, false, ['decrypt']);
+    const keyData = Module.HEAPU8.subarray(keyBuff, keyBuff + keySize);  // copied if it's imported
+    const entry = Module.aesGcmKeyEntrySync(connId, aes, keyData);
+    const key = await entry.key;
+
+    const readAheadPlainText = await Module.readAheadDecrypt(connId, entry, iv, additionalData, data, authTag);
+    if (readAheadPlainText !== null) {
+        Module.HEAPU8.set(readAheadPlainText, outBuff);
+        return 0;
+    }
 
-    const data = Module.HEAPU8.subarray(dataBuff, dataBuff + dataSz);
-    const authTag = Module.HEAPU8.subarray(authTagBuff, authTagBuff + authTagSz);
     const taggedData = new Uint8Array(dataSz + authTagSz);
     taggedData.set(data);
     taggedData.set(authTag, dataSz);
@@ -173,8 +902,114 @@ EM_ASYNC_JS(int, jsAesGcmDecrypt, (
     }    
 });
 
+// times both sides at sizes from a Postgres Sync up to a full record: a threshold is the smallest
+// size from which WebCrypto is faster all the way up. Returns 0, or -1 if the clock didn't advance
+// (in which case the policy is left alone). The connection id -1 keeps the key out of everyone's way.
+#define CALIBRATION_REPS 4
+
+int tlsCalibrate(void) {
+    static const int sizes[] = { 64, 256, 1024, 4096, 16384 };
+    const int nSizes = sizeof sizes / sizeof sizes[0], maxSize = 16384;
+    byte key[32] = { 0 }, iv[12] = { 0 }, tag[16], digest[WC_SHA256_DIGEST_SIZE];
+    Aes aes;
+    if (wc_AesInit(&aes, NULL, INVALID_DEVID) != 0) return -1;
+    byte *in = calloc(1, maxSize), *out = malloc(maxSize);
+    int result = -1;
+
+    if (in == NULL || out == NULL || wc_AesGcmSetKey(&aes, key, 16) != 0) goto exit;
+    jsInitAesKeyCache(&policy);
+
+    int aesThreshold = INT_MAX, shaThreshold = INT_MAX, aesWinning = 1, shaWinning = 1;
+    double wasmMs = 0, aesFastestMs = 0;
+    for (int i = nSizes - 1; i >= 0; i--) {  // largest first, so each threshold stops at the first loss
+        int len = sizes[i];
+
+        double started = emscripten_get_now();
+        for (int r = 0; r < CALIBRATION_REPS; r++) wc_AesGcmEncrypt(&aes, out, in, len, iv, sizeof iv, tag, sizeof tag, NULL, 0);
+        double aesWasmMs = emscripten_get_now() - started;
+        if (len == maxSize) {
+            if (aesWasmMs == 0) goto exit;  // the clock is stopped (as in Workers), so stop before any WebCrypto
+            jsAesGcmEncrypt(-1, &aes, in, sizes[0], key, 16, iv, sizeof iv, NULL, 0, tag, sizeof tag, out);  // imports the key
+        }
+
+        started = emscripten_get_now();
+        for (int r = 0; r < CALIBRATION_REPS; r++) jsAesGcmEncrypt(-1, &aes, in, len, key, 16, iv, sizeof iv, NULL, 0, tag, sizeof tag, out);
+        double aesJsMs = emscripten_get_now() - started;
+
+        started = emscripten_get_now();
+        for (int r = 0; r < CALIBRATION_REPS; r++) wc_Sha256Hash(in, len, digest);
+        double shaWasmMs = emscripten_get_now() - started;
+
+        started = emscripten_get_now();
+        for (int r = 0; r < CALIBRATION_REPS; r++) jsSha(256, in, len, digest);
+        double shaJsMs = emscripten_get_now() - started;
+
+        if (aesWinning && aesJsMs < aesWasmMs) aesThreshold = len;
+        else aesWinning = 0;
+        if (shaWinning && shaJsMs < shaWasmMs) shaThreshold = len;
+        else shaWinning = 0;
+        if (len == maxSize) aesFastestMs = aesJsMs < aesWasmMs ? aesJsMs : aesWasmMs;
+        wasmMs += aesWasmMs + shaWasmMs;
+    }
+
+    double started = emscripten_get_now();
+    for (int r = 0; r < CALIBRATION_REPS; r++) wc_ChaCha20Poly1305_Encrypt(key, iv, NULL, 0, in, maxSize, out, tag);
+    double chaChaMs = emscripten_get_now() - started;
+
+    if (wasmMs > 0) {
+        policy.aesOffloadThreshold = aesThreshold;
+        policy.shaOffloadThreshold = shaThreshold;
+        policy.preferChaCha = chaChaMs < aesFastestMs;
+        policy.calibrated = 1;
+        result = 0;
+    }
+
+    #ifdef CHATTY
+        printf("calibrated: AES-GCM offload from %i, SHA from %i, prefer ChaCha %i\n",
+            policy.aesOffloadThreshold, policy.shaOffloadThreshold, policy.preferChaCha);
+    #endif
+
+exit:
+    jsForgetAesKeys(-1);
+    wc_AesFree(&aes);
+    free(in);
+    free(out);
+    return result;
+}
+
+#endif
+
+Connection *getConnection(int id) {
+    if (id < 0 || id >= MAX_CONNECTIONS) return NULL;
+    return connections[id];
+}
+
+void freeConnection(Connection *conn) {
+    if (conn->ssl) wolfSSL_free(conn->ssl);
+    #ifdef USESUBTLECB
+        jsForgetAesKeys(conn->id);
+        #ifndef STATIC_MEMORY  // otherwise they go with the arena
+            while (conn->hashBuffers != NULL) {
+                HashBuffer *next = conn->hashBuffers->next;
+                free(conn->hashBuffers->data.data);
+                free(conn->hashBuffers);
+                conn->hashBuffers = next;
+            }
+        #endif
+    #endif
+    if (currentConnection == conn) currentConnection = NULL;
+    connections[conn->id] = NULL;
+    #ifndef STATIC_MEMORY  // the slot is cleared when it's next used
+        free(conn->output.data);
+        free(conn->input.data);
+        free(conn);
+    #endif
+}
+
 #ifdef USESUBTLECB
     int cryptCb(int devId, wc_CryptoInfo *info, void* ctx) {
+        if (currentConnection == NULL) return CRYPTOCB_UNAVAILABLE;  // e.g. while the context is set up
+
         // TODO: test for WC_ALGO_TYPE_SEED here instead of patching WolfSSL source?
         if (info->algo_type == WC_ALGO_TYPE_CIPHER && info->cipher.type == WC_CIPHER_AES_GCM) {
             if (info->cipher.enc == 1) {
@@ -195,7 +1030,12 @@ EM_ASYNC_JS(int, jsAesGcmDecrypt, (
                     );
                 #endif
 
+                if (info->cipher.aesgcm_enc.sz < policy.aesOffloadThreshold) return CRYPTOCB_UNAVAILABLE;
+
+                double started = emscripten_get_now();
                 jsAesGcmEncrypt(
+                    currentConnection->id,
+                    info->cipher.aesgcm_enc.aes,
                     info->cipher.aesgcm_enc.in, 
                     info->cipher.aesgcm_enc.sz, 
                     (byte *)info->cipher.aesgcm_enc.aes->devKey, 
@@ -208,6 +1048,7 @@ EM_ASYNC_JS(int, jsAesGcmDecrypt, (
                     info->cipher.aesgcm_enc.authTagSz, 
                     info->cipher.aesgcm_enc.out
                 );
+                countCrypto(STATS_AES_GCM_ENCRYPT, started);
 
             } else {
                 #ifdef CHATTY
@@ -227,7 +1068,27 @@ EM_ASYNC_JS(int, jsAesGcmDecrypt, (
                     );
                 #endif
 
+                if (info->cipher.aesgcm_dec.sz < policy.aesOffloadThreshold) {
+                    jsReadAheadSkip(
+                        currentConnection->id,
+                        info->cipher.aesgcm_dec.aes,
+                        (byte *)info->cipher.aesgcm_dec.aes->devKey,
+                        info->cipher.aesgcm_dec.aes->keylen,
+                        info->cipher.aesgcm_dec.iv,
+                        info->cipher.aesgcm_dec.ivSz,
+                        info->cipher.aesgcm_dec.authIn,
+                        info->cipher.aesgcm_dec.authInSz,
+                        info->cipher.aesgcm_dec.authTag,
+                        info->cipher.aesgcm_dec.authTagSz,
+                        info->cipher.aesgcm_dec.sz
+                    );
+                    return CRYPTOCB_UNAVAILABLE;
+                }
+
+                double started = emscripten_get_now();
                 int result = jsAesGcmDecrypt(
+                    currentConnection->id,
+                    info->cipher.aesgcm_dec.aes,
                     info->cipher.aesgcm_dec.in, 
                     info->cipher.aesgcm_dec.sz, 
                     (byte *)info->cipher.aesgcm_dec.aes->devKey, 
@@ -240,24 +1101,33 @@ EM_ASYNC_JS(int, jsAesGcmDecrypt, (
                     info->cipher.aesgcm_dec.authTagSz, 
                     info->cipher.aesgcm_dec.out
                 );
+                countCrypto(STATS_AES_GCM_DECRYPT, started);
                 if (result == -1) return AES_GCM_AUTH_E;
 
             }
             return 0;
 
-        } else if (hasDigestStream && info->algo_type == WC_ALGO_TYPE_HASH && (
+        } else if (info->algo_type == WC_ALGO_TYPE_HASH && (
             info->hash.type == WC_HASH_TYPE_SHA ||
             info->hash.type == WC_HASH_TYPE_SHA256 || 
             info->hash.type == WC_HASH_TYPE_SHA384 || 
             info->hash.type == WC_HASH_TYPE_SHA512)) {
 
-            int shaVersion = 
-            info->hash.type == WC_HASH_TYPE_SHA256 ? 256 :
-            info->hash.type == WC_HASH_TYPE_SHA384 ? 384 : 
-            info->hash.type == WC_HASH_TYPE_SHA512 ? 512 : 1;
-            
-            jsSha(shaVersion, info->hash.in, info->hash.inSz, info->hash.digest);
-            return 0;
+            return bufferedHash(info);
+
+        } else if (info->algo_type == WC_ALGO_TYPE_PK && info->pk.type == WC_PK_TYPE_EC_KEYGEN) {
+            return offloadEccKeygen(info);
+
+        } else if (info->algo_type == WC_ALGO_TYPE_PK && info->pk.type == WC_PK_TYPE_ECDH) {
+            return offloadEcdh(info);
+
+        #ifdef HAVE_CURVE25519
+        } else if (info->algo_type == WC_ALGO_TYPE_PK && info->pk.type == WC_PK_TYPE_CURVE25519_KEYGEN) {
+            return offloadX25519Keygen(info);
+
+        } else if (info->algo_type == WC_ALGO_TYPE_PK && info->pk.type == WC_PK_TYPE_CURVE25519) {
+            return offloadX25519(info);
+        #endif
 
         } else {
             #ifdef CHATTY
@@ -265,16 +1135,14 @@ EM_ASYNC_JS(int, jsAesGcmDecrypt, (
                 if (info->algo_type == WC_ALGO_TYPE_HASH) printf("hash.type %i\n\n", info->hash.type);
                 if (info->algo_type == WC_ALGO_TYPE_PK) printf("pk.type %i\n\n", info->pk .type);
                 if (info->algo_type == WC_ALGO_TYPE_HMAC) printf("hmac.macType %i\n\n", info->hmac.macType);
-                // potential further ops are ECC keygen (3, 9), ECDH (3, 3), RSA (3, 1) and SHA256-HMAC (6, 6)
+                // what's left is mostly RSA (3, 1), ECDSA verify (3, 5) and HMAC (6, x): see jsEcGenerateKey
             #endif
             return CRYPTOCB_UNAVAILABLE;
         }
     }
 #endif
 
-int initTls(char *tlsHost, const unsigned char *rootCert, int rootCertLength, int disableSNI) {
-    hasDigestStream = checkForDigestStream();
-
+int initContext(Context *c, const unsigned char *rootCert, int rootCertLength) {
     #ifdef CHATTY
         puts("WolfSSL initializing ...");
     #endif
@@ -283,45 +1151,126 @@ int initTls(char *tlsHost, const unsigned char *rootCert, int rootCertLength, in
     #ifdef CHATTY
         puts("WolfSSL creating context ...");
     #endif
-    ctx = wolfSSL_CTX_new(wolfTLS_client_method());
-    if (ctx == NULL) {
+    #ifdef STATIC_MEMORY
+        // the context, and every WOLFSSL made from it, allocates from these pools, with a per-connection
+        // count of what it took (see tlsStats); WolfSSL also turns away connections beyond MAX_CONNECTIONS
+        ret = wolfSSL_CTX_load_static_memory(&c->ctx, wolfTLS_client_method_ex, pool, sizeof(pool),
+            WOLFMEM_GENERAL | WOLFMEM_TRACK_STATS, MAX_CONNECTIONS);
+        if (ret == WOLFSSL_SUCCESS) {
+            ret = wolfSSL_CTX_load_static_memory(&c->ctx, NULL, ioPool, sizeof(ioPool), WOLFMEM_IO_POOL, MAX_CONNECTIONS);
+            if (ret != WOLFSSL_SUCCESS) goto exit;
+        }
+    #else
+        c->ctx = wolfSSL_CTX_new(wolfTLS_client_method());
+    #endif
+    if (c->ctx == NULL) {
         fprintf(stderr, "ERROR: failed to create WOLFSSL_CTX\n");
-        ret = -1;
-        goto exit;
+        return -1;
     }
 
     #ifdef CHATTY
-        puts("WolfSSL loading verify buffer ...");
+        puts("WolfSSL loading trust anchors ...");
     #endif
-    ret = wolfSSL_CTX_load_verify_buffer(ctx, rootCert, rootCertLength, WOLFSSL_FILETYPE_PEM);
-    if (ret != WOLFSSL_SUCCESS) {
-        fprintf(stderr, "ERROR: failed to load cert, please check the buffer.\n");
-        goto exit;
+    for (int i = 0; i < TAs_NUM; i++) {  // DER, so there's no base64 to decode
+        ret = wolfSSL_CTX_load_verify_buffer(c->ctx, TAs_DER[i].data, TAs_DER[i].len, WOLFSSL_FILETYPE_ASN1);
+        if (ret != WOLFSSL_SUCCESS) fprintf(stderr, "WARNING: failed to load built-in trust anchor %i\n", i);
+    }
+
+    if (rootCertLength > 0) {  // in addition to the built-in ones
+        #ifdef CHATTY
+            puts("WolfSSL loading verify buffer ...");
+        #endif
+        ret = wolfSSL_CTX_load_verify_buffer(c->ctx, rootCert, rootCertLength, WOLFSSL_FILETYPE_PEM);
+        if (ret != WOLFSSL_SUCCESS) {
+            fprintf(stderr, "ERROR: failed to load cert, please check the buffer.\n");
+            goto exit;
+        }
     }
 
     #ifdef CHATTY
         puts("Setting I/O callbacks ...");
     #endif
-    wolfSSL_SetIORecv(ctx, my_IORecv);
-    wolfSSL_SetIOSend(ctx, my_IOSend);
+    wolfSSL_SetIORecv(c->ctx, my_IORecv);
+    wolfSSL_SetIOSend(c->ctx, my_IOSend);
+
+    #ifdef USESUBTLECB
+        #ifdef CHATTY
+            puts("Registering callback ...");
+        #endif
+        jsInitAesKeyCache(&policy);
+        ret = wc_CryptoCb_RegisterDevice(1, &cryptCb, NULL);
+        if (ret != 0) {
+            fprintf(stderr, "ERROR: failed to register callback.\n");
+            goto exit;
+        }
+    #endif
+
+    return 0;
+
+exit:
+    wolfSSL_CTX_free(c->ctx);
+    c->ctx = NULL;
+    return -1;
+}
+
+// the context for a root cert (or none), made on first use
+WOLFSSL_CTX *contextFor(const unsigned char *rootCert, int rootCertLength) {
+    byte digest[WC_SHA256_DIGEST_SIZE];
+    if (wc_Sha256Hash(rootCert, rootCertLength, digest) != 0) return NULL;
+
+    int i = 0;
+    while (i < MAX_CONTEXTS && contexts[i].ctx != NULL && memcmp(contexts[i].rootCertDigest, digest, sizeof digest) != 0) i++;
+    if (i == MAX_CONTEXTS) {
+        fprintf(stderr, "ERROR: no context left for another root cert (see MAX_CONTEXTS)\n");
+        return NULL;
+    }
+    if (contexts[i].ctx == NULL) {
+        if (initContext(&contexts[i], rootCert, rootCertLength) != 0) return NULL;
+        memcpy(contexts[i].rootCertDigest, digest, sizeof digest);
+    }
+    return contexts[i].ctx;
+}
+
+// returns a connection id, or -1 on error; the handshake happens later, in tlsConnect
+int tlsOpen(char *tlsHost, const unsigned char *rootCert, int rootCertLength, int disableSNI) {
+    WOLFSSL_CTX *ctx = contextFor(rootCert, rootCertLength);
+    if (ctx == NULL) return -1;
+
+    int id = 0;
+    while (id < MAX_CONNECTIONS && connections[id] != NULL) id++;
+    if (id == MAX_CONNECTIONS) {
+        fprintf(stderr, "ERROR: too many connections\n");
+        return -1;
+    }
+
+    #ifdef STATIC_MEMORY
+        Connection *conn = &connectionSlots[id];
+        memset(conn, 0, offsetof(Connection, arenaSpace));
+        arenaReset(&conn->arena, conn->arenaSpace, ARENA_SIZE);
+        conn->output.arena = conn->input.arena = &conn->arena;
+    #else
+        Connection *conn = calloc(1, sizeof(Connection));
+        if (conn == NULL) {
+            fprintf(stderr, "ERROR: failed to allocate connection\n");
+            return -1;
+        }
+    #endif
+    conn->id = id;
+    connections[id] = conn;
 
     #ifdef CHATTY
         puts("Creating SSL object ...");
     #endif
-    ssl = wolfSSL_new(ctx);
-    if (ssl == NULL) {
+    conn->ssl = wolfSSL_new(ctx);
+    if (conn->ssl == NULL) {
         fprintf(stderr, "ERROR: failed to create WOLFSSL object\n");
-        ret = -1;
         goto exit;
     }
+    wolfSSL_SetIOReadCtx(conn->ssl, conn);
+    wolfSSL_SetIOWriteCtx(conn->ssl, conn);
 
     #ifdef USESUBTLECB
-        #ifdef CHATTY
-            puts("Registering callback ...");
-        #endif
-        int devId = 1;
-        wc_CryptoCb_RegisterDevice(devId, &cryptCb, NULL);
-        ret = wolfSSL_SetDevId(ssl, devId);
+        ret = wolfSSL_SetDevId(conn->ssl, 1);
         if (ret != WOLFSSL_SUCCESS) {
             fprintf(stderr, "ERROR: failed to register callback.\n");
             goto exit;
@@ -333,9 +1282,11 @@ int initTls(char *tlsHost, const unsigned char *rootCert, int rootCertLength, in
     #endif
 
     #ifdef USESUBTLECB
-        ret = wolfSSL_set_cipher_list(ssl, "TLS13-AES128-GCM-SHA256:TLS13-AES256-GCM-SHA384:TLS13-CHACHA20-POLY1305-SHA256");
+        ret = wolfSSL_set_cipher_list(conn->ssl, policy.preferChaCha ?
+            "TLS13-CHACHA20-POLY1305-SHA256:TLS13-AES128-GCM-SHA256:TLS13-AES256-GCM-SHA384" :
+            "TLS13-AES128-GCM-SHA256:TLS13-AES256-GCM-SHA384:TLS13-CHACHA20-POLY1305-SHA256");
     #else
-        ret = wolfSSL_set_cipher_list(ssl, "TLS13-CHACHA20-POLY1305-SHA256:TLS13-AES128-GCM-SHA256:TLS13-AES256-GCM-SHA384");
+        ret = wolfSSL_set_cipher_list(conn->ssl, "TLS13-CHACHA20-POLY1305-SHA256:TLS13-AES128-GCM-SHA256:TLS13-AES256-GCM-SHA384");
     #endif
     if (ret != WOLFSSL_SUCCESS) {
         fprintf(stderr, "ERROR: failed to set ciphers\n");
@@ -346,47 +1297,88 @@ int initTls(char *tlsHost, const unsigned char *rootCert, int rootCertLength, in
         #ifdef CHATTY
             puts("Enabling SNI ...");
         #endif
-        ret = wolfSSL_UseSNI(ssl, WOLFSSL_SNI_HOST_NAME, tlsHost, strlen(tlsHost));
+        ret = wolfSSL_UseSNI(conn->ssl, WOLFSSL_SNI_HOST_NAME, tlsHost, strlen(tlsHost));
         if (ret != WOLFSSL_SUCCESS) {
             fprintf(stderr, "ERROR: failed to set host for SNI\n");
             goto exit;
         }
     }
 
+    #ifdef LEAN_MEMORY
+        // WolfSSL's record buffers grow only as far as the records it sees, so this is what keeps them small
+        ret = wolfSSL_UseMaxFragment(conn->ssl, __builtin_ctz(MAX_FRAGMENT) - 8);  // WOLFSSL_MFL_2_9 is 1
+        if (ret != WOLFSSL_SUCCESS) {
+            fprintf(stderr, "ERROR: failed to set max fragment length\n");
+            goto exit;
+        }
+    #endif
+
     #ifdef CHATTY
         puts("Enabling domain name check...");
     #endif
-    ret = wolfSSL_check_domain_name(ssl, tlsHost);
+    ret = wolfSSL_check_domain_name(conn->ssl, tlsHost);
     if (ret != WOLFSSL_SUCCESS) {
         puts("Failed to enable domain name check");
         goto exit;
     };
 
+    return id;
+
+exit:
+    freeConnection(conn);
+    return -1;
+}
+
+#ifndef NONBLOCKING
+// with ASYNCIFY, makes tlsConnect, readData and readDataInPlace return TLS_WANT_READ, rather than
+// suspend, when they've used up what JS has queued: JS can then wait for the network without holding
+// up other connections' calls into the module (ASYNCIFY allows only one suspended call at a time)
+int tlsSetNonBlocking(int id, int nonBlocking) {
+    Connection *conn = getConnection(id);
+    if (conn == NULL) return -1;
+
+    conn->nonBlocking = nonBlocking;
+    return 0;
+}
+#endif
+
+int tlsConnect(int id) {
+    Connection *conn = getConnection(id);
+    if (conn == NULL) return -1;
+    currentConnection = conn;
+
     #ifdef CHATTY
         puts("Connecting ...");
     #endif
-    ret = wolfSSL_connect(ssl);
+    ret = wolfSSL_connect(conn->ssl);
+    flushEncrypted(conn);  // the final flight, or an alert
     if (ret != WOLFSSL_SUCCESS) {
-        int err = wolfSSL_get_error(ssl, ret);
+        int err = wolfSSL_get_error(conn->ssl, ret);
+        if (err == WOLFSSL_ERROR_WANT_READ) return TLS_WANT_READ;  // non-blocking (see tlsSetNonBlocking)
+        if (err == WOLFSSL_ERROR_WANT_WRITE) return TLS_WANT_WRITE;
         fprintf(stderr, "ERROR: failed to connect to wolfSSL, error %i\n", err);
-        goto exit;
+        return -1;
     }
 
     #ifdef CHATTY
-        const char *cipher = wolfSSL_get_cipher_name(ssl);
+        const char *cipher = wolfSSL_get_cipher_name(conn->ssl);
         printf("WolfSSL connected with cipher: %s\n", cipher);
     #endif
 
     return 0;
-
-exit:
-    cleanup();
-    return -1;
 }
 
-int readData(char *buff, int sz) {
-    ret = wolfSSL_read(ssl, buff, sz);
+int readData(int id, char *buff, int sz) {
+    Connection *conn = getConnection(id);
+    if (conn == NULL) return -1;
+    currentConnection = conn;
+
+    ret = wolfSSL_read(conn->ssl, buff, sz);
+    flushEncrypted(conn);  // e.g. a KeyUpdate in reply
     if (ret < 0) {
+        int err = wolfSSL_get_error(conn->ssl, ret);
+        if (err == WOLFSSL_ERROR_WANT_READ) return TLS_WANT_READ;
+        if (err == WOLFSSL_ERROR_WANT_WRITE) return TLS_WANT_WRITE;
         fprintf(stderr, "ERROR: failed to read\n");
         return ret;
     }
@@ -399,20 +1391,211 @@ int readData(char *buff, int sz) {
     return ret;
 }
 
-int writeData(char *buff, int sz) {
-    ret = wolfSSL_write(ssl, buff, sz);
-    if (ret != sz) {
+// like readData, but into the connection's own receive buffer (see readDataPointer), so that JS
+// needn't allocate and free a buffer per call; the bytes stay valid until the next call
+int readDataInPlace(int id) {
+    Connection *conn = getConnection(id);
+    if (conn == NULL) return -1;
+
+    return readData(id, (char *)conn->recvBuf, RECV_BUFFER_SIZE);
+}
+
+unsigned char *readDataPointer(int id) {
+    Connection *conn = getConnection(id);
+    if (conn == NULL) return NULL;
+
+    return conn->recvBuf;
+}
+
+int writeData(int id, char *buff, int sz) {
+    Connection *conn = getConnection(id);
+    if (conn == NULL) return -1;
+    currentConnection = conn;
+
+    ret = wolfSSL_write(conn->ssl, buff, sz);
+    if (flushEncrypted(conn) < 0) return -1;
+    if (ret <= 0 && sz > 0) {
+        int err = wolfSSL_get_error(conn->ssl, ret);
+        if (err == WOLFSSL_ERROR_WANT_READ) return TLS_WANT_READ;
+        if (err == WOLFSSL_ERROR_WANT_WRITE) return TLS_WANT_WRITE;
         fprintf(stderr, "ERROR: failed to write\n");
+        return -1;
     }
-    return ret;
+    return ret;  // the number of bytes written, as from BearSSL
 }
 
-int pending() {
-    ret = wolfSSL_pending(ssl);
+int pending(int id) {
+    Connection *conn = getConnection(id);
+    if (conn == NULL) return -1;
+
+    ret = wolfSSL_pending(conn->ssl);
     return ret;
 }
 
-int shutdown() {
-    ret = wolfSSL_shutdown(ssl);
+int hasPending(int id) {  // covers decrypted data, buffered records not yet processed, and read-ahead
+    Connection *conn = getConnection(id);
+    if (conn == NULL) return 0;
+
+    return wolfSSL_has_pending(conn->ssl) || conn->input.end > conn->input.start;
+}
+
+int tlsShutdown(int id) {  // not "shutdown", which would clash with sys/socket.h in native builds
+    Connection *conn = getConnection(id);
+    if (conn == NULL) return -1;
+    currentConnection = conn;
+
+    ret = wolfSSL_shutdown(conn->ssl);
+    flushEncrypted(conn);
     return ret;
 }
+
+// === Session resumption ===
+
+// call between tlsOpen and tlsConnect, with data previously returned by tlsGetSession
+int tlsSetSession(int id, const unsigned char *data, int len) {
+    Connection *conn = getConnection(id);
+    if (conn == NULL) return -1;
+
+    WOLFSSL_SESSION *session = wolfSSL_d2i_SSL_SESSION(NULL, &data, len);
+    if (session == NULL) {
+        fprintf(stderr, "ERROR: failed to decode session\n");
+        return -1;
+    }
+    ret = wolfSSL_set_session(conn->ssl, session);
+    wolfSSL_SESSION_free(session);
+    return ret == WOLFSSL_SUCCESS ? 0 : -1;
+}
+
+// TLS 1.3 tickets arrive after the handshake, so call this once some data has been read;
+// returns the length of the serialized session, or -1 if there isn't one or it doesn't fit
+int tlsGetSession(int id, unsigned char *buff, int sz) {
+    Connection *conn = getConnection(id);
+    if (conn == NULL) return -1;
+
+    WOLFSSL_SESSION *session = wolfSSL_get_session(conn->ssl);
+    if (session == NULL) return -1;
+
+    int sessionLen = wolfSSL_i2d_SSL_SESSION(session, NULL);
+    if (sessionLen <= 0 || sessionLen > sz) return -1;
+
+    return wolfSSL_i2d_SSL_SESSION(session, &buff);
+}
+
+int tlsSessionReused(int id) {
+    Connection *conn = getConnection(id);
+    if (conn == NULL) return 0;
+
+    return wolfSSL_session_reused(conn->ssl);
+}
+
+// === ALPN (e.g. "postgresql", which PostgreSQL 17 requires for direct TLS negotiation) ===
+
+// call between tlsOpen and tlsConnect, with a single protocol name to offer
+int tlsSetAlpn(int id, char *protocol) {
+    Connection *conn = getConnection(id);
+    if (conn == NULL) return -1;
+
+    #ifdef HAVE_ALPN  // see buildwolflib.sh: a system WolfSSL, for the native build, may not have it
+        ret = wolfSSL_UseALPN(conn->ssl, protocol, strlen(protocol), WOLFSSL_ALPN_CONTINUE_ON_MISMATCH);
+        return ret == WOLFSSL_SUCCESS ? 0 : -1;
+    #else
+        return -1;
+    #endif
+}
+
+int tlsAlpnSelected(int id) {  // 1 if the server picked the protocol offered
+    Connection *conn = getConnection(id);
+    if (conn == NULL) return 0;
+
+    #ifdef HAVE_ALPN
+        char *name;
+        word16 nameLen;
+        return wolfSSL_ALPN_GetProtocol(conn->ssl, &name, &nameLen) == WOLFSSL_SUCCESS && nameLen > 0;
+    #else
+        return 0;
+    #endif
+}
+
+// see stats.h
+TlsStats *tlsStats(int id) {
+    Connection *conn = getConnection(id);
+    if (conn == NULL) return NULL;
+
+    #ifdef STATIC_MEMORY  // the shim's arena, plus what WolfSSL took from the pools for this connection
+        WOLFSSL_MEM_CONN_STATS mem = { 0 };
+        if (conn->ssl != NULL) wolfSSL_is_static_memory(conn->ssl, &mem);
+        conn->stats.heapPeak = conn->arena.used + mem.peakMem;
+        conn->stats.heapAllocs = conn->arena.allocs + mem.totalAlloc;
+    #endif
+    return &conn->stats;
+}
+
+// the negotiated suite and version as their IANA code points, e.g. 0x1301 and 0x0304, or 0 before the handshake
+int tlsCipherSuite(int id) {
+    Connection *conn = getConnection(id);
+    if (conn == NULL || !wolfSSL_is_init_finished(conn->ssl)) return 0;
+
+    return wolfSSL_get_current_cipher_suite(conn->ssl);
+}
+
+int tlsProtocolVersion(int id) {
+    Connection *conn = getConnection(id);
+    if (conn == NULL || !wolfSSL_is_init_finished(conn->ssl)) return 0;
+
+    return wolfSSL_version(conn->ssl);
+}
+
+void tlsClose(int id) {
+    Connection *conn = getConnection(id);
+    if (conn == NULL) return;
+    freeConnection(conn);
+}
+
+#ifdef NONBLOCKING
+
+// === Non-blocking, buffer-driven I/O: JS pushes and pulls ciphertext, and nothing ever suspends ===
+
+// returns a pointer to space for len bytes of ciphertext, which JS fills before calling feedEncrypted
+unsigned char *encryptedInputBuffer(int id, int len) {
+    Connection *conn = getConnection(id);
+    if (conn == NULL) return NULL;
+
+    return bufferReserve(&conn->input, len);
+}
+
+// commits len bytes written to encryptedInputBuffer; a len of 0 signals that the socket has closed
+int feedEncrypted(int id, int len) {
+    Connection *conn = getConnection(id);
+    if (conn == NULL) return -1;
+
+    if (len == 0) conn->inputClosed = 1;
+    else conn->input.end += len;
+    conn->stats.networkReads++;
+    conn->stats.networkBytes += len;
+    return 0;
+}
+
+int pendingEncrypted(int id) {
+    Connection *conn = getConnection(id);
+    if (conn == NULL) return 0;
+
+    return conn->output.end - conn->output.start;
+}
+
+unsigned char *encryptedOutputBuffer(int id) {
+    Connection *conn = getConnection(id);
+    if (conn == NULL) return NULL;
+
+    return conn->output.data + conn->output.start;
+}
+
+// marks len bytes from encryptedOutputBuffer as sent
+void takeEncrypted(int id, int len) {
+    Connection *conn = getConnection(id);
+    if (conn == NULL) return;
+
+    conn->output.start += len;
+    if (conn->output.start == conn->output.end) conn->output.start = conn->output.end = 0;
+}
+
+#endif
@@ -0,0 +1,237 @@
+/**
+ * Many proxied TCP connections over one WebSocket to the proxy, so that only the first connection
+ * pays for a WebSocket upgrade, and the proxy holds one WebSocket per tunnel rather than one per
+ * connection. A client asks for the `wsmux.v1` subprotocol on an upgrade to `?mux=1`, and a proxy that
+ * multiplexes answers with a HELLO frame. If it doesn't, MuxTunnel.open returns null and WsTls falls
+ * back to a WebSocket per connection.
+ *
+ * Each WebSocket message is one frame: type (1 byte), stream id (4 bytes, big-endian), payload.
+ *   HELLO   proxy to client, on stream 0, first thing after the upgrade
+ *   OPEN    client to proxy, with payload "host:port"; the client picks the (non-zero) ids
+ *   DATA    either way: bytes of the stream
+ *   CLOSE   either way: the stream is finished, in both directions; the payload may give a reason
+ *   WINDOW  either way: a 4-byte big-endian count of DATA bytes consumed, which the peer may now send
+ *
+ * Flow control is per stream and per direction: neither side may have more than MUX_WINDOW DATA bytes
+ * unacknowledged by WINDOW frames. The client acknowledges bytes as the TLS engine takes them off its
+ * queue (see SocketLike.consumed), so a result set that isn't being read stops the proxy reading
+ * that stream's TCP socket, and the others keep flowing. The proxy in bench/e2e/proxy.mjs is the
+ * reference implementation of the other side.
+ */
+
+export const MUX_PROTOCOL = 'wsmux.v1';
+export const MUX_OPEN = 0, MUX_DATA = 1, MUX_CLOSE = 2, MUX_WINDOW = 3, MUX_HELLO = 4;
+export const MUX_WINDOW_SIZE = 262144;
+const HEADER_SIZE = 5;
+const HELLO_TIMEOUT_MS = 5000;
+
+// what WsTls needs of a socket: a Workers WebSocket (once accepted), or a MuxStream
+export interface SocketLike {
+  send(data: Uint8Array): void;
+  close(): void;
+  addEventListener(type: 'message' | 'close' | 'error', listener: (event: any) => void): void;
+  consumed?(bytes: number): void;  // received bytes have been taken off the queue
+}
+
+function frame(type: number, id: number, payloadLength: number) {
+  const bytes = new Uint8Array(HEADER_SIZE + payloadLength);
+  bytes[0] = type;
+  new DataView(bytes.buffer).setUint32(1, id);
+  return bytes;
+}
+
+export class MuxStream implements SocketLike {
+  #listeners = new Map<string, ((event: any) => void)[]>();
+  #sendWindow = MUX_WINDOW_SIZE;
+  #recvWindow = MUX_WINDOW_SIZE;
+  #unacknowledged = 0;  // consumed but not yet credited back to the proxy
+  #pending: Uint8Array[] = [];  // waiting for window
+  #closed = false;
+
+  constructor(private tunnel: MuxTunnel, readonly id: number) { }
+
+  addEventListener(type: string, listener: (event: any) => void) {
+    const listeners = this.#listeners.get(type) ?? [];
+    listeners.push(listener);
+    this.#listeners.set(type, listeners);
+  }
+
+  send(data: Uint8Array) {
+    if (this.#closed) return;
+    this.#pending.push(data);
+    this.#flush();
+  }
+
+  consumed(bytes: number) {
+    if (this.#closed) return;
+    this.#unacknowledged += bytes;
+    if (this.#unacknowledged < MUX_WINDOW_SIZE / 2) return;  // credit in batches
+
+    const window = frame(MUX_WINDOW, this.id, 4);
+    new DataView(window.buffer).setUint32(HEADER_SIZE, this.#unacknowledged);
+    this.#recvWindow += this.#unacknowledged;
+    this.#unacknowledged = 0;
+    this.tunnel.sendFrame(window);
+  }
+
+  close() {
+    if (this.#closed) return;
+    this.tunnel.sendFrame(frame(MUX_CLOSE, this.id, 0));
+    this.closed();
+  }
+
+  // from the tunnel
+  received(type: number, payload: Uint8Array) {
+    if (type === MUX_DATA) {
+      this.#recvWindow -= payload.length;
+      if (this.#recvWindow < 0) return this.close();  // the proxy ignored flow control
+      this.#dispatch('message', { data: payload });
+
+    } else if (type === MUX_WINDOW) {
+      this.#sendWindow += new DataView(payload.buffer, payload.byteOffset).getUint32(0);
+      this.#flush();
+
+    } else if (type === MUX_CLOSE) {
+      this.closed();
+    }
+  }
+
+  closed() {
+    if (this.#closed) return;
+    this.#closed = true;
+    this.#pending = [];
+    this.tunnel.forget(this.id);
+    queueMicrotask(() => this.#dispatch('close', {}));  // like a WebSocket, never during close()
+  }
+
+  #flush() {
+    while (this.#pending.length > 0 && this.#sendWindow > 0) {
+      let data = this.#pending[0];
+      if (data.length > this.#sendWindow) {
+        this.#pending[0] = data.subarray(this.#sendWindow);
+        data = data.subarray(0, this.#sendWindow);
+      } else {
+        this.#pending.shift();
+      }
+      const dataFrame = frame(MUX_DATA, this.id, data.length);
+      dataFrame.set(data, HEADER_SIZE);
+      this.#sendWindow -= data.length;
+      this.tunnel.sendFrame(dataFrame);
+    }
+  }
+
+  #dispatch(type: string, event: any) {
+    for (const listener of this.#listeners.get(type) ?? []) listener(event);
+  }
+}
+
+/**
+ * One multiplexed WebSocket to a proxy, opened by the first stream and reopened by the first stream
+ * after it closes. In Workers, a WebSocket opened by one request can't be used by another, so make a
+ * tunnel per request and close() it at the end, unless in a Durable Object.
+ */
+export class MuxTunnel {
+  #socket: WebSocket | null = null;
+  #connecting: Promise<WebSocket | null> | null = null;
+  #streams = new Map<number, MuxStream>();
+  #nextId = 1;
+  unsupported = false;  // the proxy turned down the subprotocol: use a WebSocket per connection
+
+  stats = { upgrades: 0, streamsOpened: 0 };
+
+  constructor(readonly wsProxy: string) { }
+
+  /** Opens a stream to host:port, or resolves to null if the proxy doesn't multiplex. */
+  async open(host: string, port: number): Promise<MuxStream | null> {
+    const socket = await this.#connect();
+    if (socket === null) return null;
+
+    const id = this.#nextId;
+    this.#nextId = this.#nextId === 0xffffffff ? 1 : this.#nextId + 1;
+    const stream = new MuxStream(this, id);
+    this.#streams.set(id, stream);
+    this.stats.streamsOpened++;
+
+    const name = new TextEncoder().encode(`${host}:${port}`);
+    const open = frame(MUX_OPEN, id, name.length);
+    open.set(name, HEADER_SIZE);
+    this.sendFrame(open);  // the proxy queues any data that arrives before it's connected
+    return stream;
+  }
+
+  get streams() {
+    return this.#streams.size;
+  }
+
+  close() {
+    this.#socket?.close();
+  }
+
+  sendFrame(bytes: Uint8Array) {
+    this.#socket?.send(bytes);
+  }
+
+  forget(id: number) {
+    this.#streams.delete(id);
+  }
+
+  #connect() {
+    if (this.#socket !== null) return Promise.resolve(this.#socket);
+    if (this.unsupported) return Promise.resolve(null);
+    if (this.#connecting !== null) return this.#connecting;
+
+    return this.#connecting = (async () => {
+      try {
+        const resp = await fetch(`${this.wsProxy}?mux=1`, { headers: { Upgrade: 'websocket', 'Sec-WebSocket-Protocol': MUX_PROTOCOL } });
+        const socket = resp.webSocket;
+        if (socket === null || socket === undefined) {
+          this.unsupported = true;
+          return null;
+        }
+        socket.accept();
+        socket.binaryType = 'arraybuffer';
+
+        // a proxy that doesn't multiplex may still accept the upgrade (and the subprotocol), so wait
+        // for HELLO; a socket that closes first (e.g. a dropped network) says nothing about the proxy,
+        // so then the next open() tries again
+        let hello!: (answer: 'hello' | 'other' | 'closed') => void;
+        const helloed = new Promise<'hello' | 'other' | 'closed'>(resolve => hello = resolve);
+        const timer = setTimeout(() => hello('other'), HELLO_TIMEOUT_MS);
+        socket.addEventListener('message', (msg: any) => {
+          const bytes = new Uint8Array(msg.data);
+          if (this.#socket === socket) this.#received(bytes);
+          else hello(bytes.length >= HEADER_SIZE && bytes[0] === MUX_HELLO ? 'hello' : 'other');
+        });
+        socket.addEventListener('close', () => {
+          hello('closed');
+          this.#lost(socket);
+        });
+        socket.addEventListener('error', () => this.#lost(socket));
+
+        const answer = await helloed;
+        clearTimeout(timer);
+        if (answer !== 'hello') {
+          socket.close();
+          if (answer === 'other') this.unsupported = true;
+          return null;
+        }
+        this.stats.upgrades++;
+        return this.#socket = socket;
+      } finally {
+        this.#connecting = null;
+      }
+    })();
+  }
+
+  #received(bytes: Uint8Array) {
+    if (bytes.length < HEADER_SIZE) return;
+    const id = new DataView(bytes.buffer, bytes.byteOffset).getUint32(1);
+    this.#streams.get(id)?.received(bytes[0], bytes.subarray(HEADER_SIZE));
+  }
+
+  #lost(socket: WebSocket) {
+    if (this.#socket !== socket) return;
+    this.#socket = null;
+    for (const stream of [...this.#streams.values()]) stream.closed();
+  }
+}
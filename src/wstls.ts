@@ -1,7 +1,8 @@
 import { tls_emscripten } from '../build/tls.js';
+import type { MuxTunnel, SocketLike } from './wsmux';
 
 // import tlswasm from '../worker/tls.wasm';
-// ^^^ note: we'll be adding this import back in after esbuild compilation, so as not to 
+// ^^^ note: we'll be adding this import back in after esbuild compilation, so as not to
 // confuse esbuild with the way Cloudflare Workers handle this
 
 declare global {
@@ -20,23 +21,374 @@ interface DataRequest {
   resolve: (bytesProvided: number) => void;
 }
 
+// status codes returned by the non-blocking build, and by non-blocking connections in the default one
+// (see TLS_WANT_READ etc. in the C sources)
+const TLS_WANT_READ = -2;
+const TLS_WANT_WRITE = -3;
+const PLATFORM_WOULD_BLOCK = -2;  // see platformRecvNow in src/platform.h
+
+/**
+ * TLS sessions are cached per host:port, so that the next connection can resume rather than
+ * repeating the full handshake: TLS 1.3 tickets for WolfSSL, TLS 1.2 session IDs for BearSSL.
+ * A serialized session contains its master secret, so treat any persistent store accordingly.
+ */
+export interface SessionStore {
+  get(key: string): Promise<Uint8Array | null> | Uint8Array | null;
+  put(key: string, session: Uint8Array): Promise<void> | void;
+}
+
+export class MemorySessionStore implements SessionStore {
+  sessions = new Map<string, Uint8Array>();
+
+  constructor(public maxEntries = 100) { }
+
+  get(key: string) {
+    return this.sessions.get(key) ?? null;
+  }
+
+  put(key: string, session: Uint8Array) {
+    this.sessions.delete(key);  // re-insert, so that Map order is least recently stored first
+    this.sessions.set(key, session);
+    if (this.sessions.size > this.maxEntries) this.sessions.delete(this.sessions.keys().next().value);
+  }
+}
+
+// anything shaped like a Workers KV namespace
+export interface KVLike {
+  get(key: string, type: 'arrayBuffer'): Promise<ArrayBuffer | null>;
+  put(key: string, value: ArrayBuffer, options?: { expirationTtl?: number }): Promise<void>;
+}
+
+export class KVSessionStore implements SessionStore {
+  constructor(public kv: KVLike, public ttlSeconds = 3600, public prefix = 'tls-session:') { }
+
+  async get(key: string) {
+    const data = await this.kv.get(this.prefix + key, 'arrayBuffer');
+    return data === null ? null : new Uint8Array(data);
+  }
+
+  async put(key: string, session: Uint8Array) {
+    await this.kv.put(this.prefix + key, session.slice().buffer, { expirationTtl: this.ttlSeconds });
+  }
+}
+
+export const defaultSessionStore = new MemorySessionStore();
+
+const MAX_SESSION_SIZE = 4096;
+
+// while corked, writes are held back until there's a full record's worth of plaintext (or a read)
+const COALESCE_THRESHOLD = 16384;
+
+function concatChunks(chunks: Uint8Array[], length: number) {
+  if (chunks.length === 1) return chunks[0];
+  const result = new Uint8Array(length);
+  let offset = 0;
+  for (const chunk of chunks) {
+    result.set(chunk, offset);
+    offset += chunk.length;
+  }
+  return result;
+}
+
+const now = typeof performance !== 'undefined' ? () => performance.now() : () => Date.now();
+
+// counts TLS records in a stream of ciphertext, however it's split into messages
+class RecordCounter {
+  records = 0;
+  bytes = 0;
+  private header = new Uint8Array(5);
+  private headerBytes = 0;
+  private bodyRemaining = 0;
+
+  add(data: Uint8Array) {
+    this.bytes += data.length;
+    let i = 0;
+    while (i < data.length) {
+      if (this.bodyRemaining > 0) {
+        const skip = Math.min(this.bodyRemaining, data.length - i);
+        this.bodyRemaining -= skip;
+        i += skip;
+      } else {
+        this.header[this.headerBytes++] = data[i++];
+        if (this.headerBytes === 5) {
+          this.records++;
+          this.bodyRemaining = this.header[3] << 8 | this.header[4];
+          this.headerBytes = 0;
+        }
+      }
+    }
+  }
+
+  get complete() {  // records whose bodies have fully arrived
+    return this.records - (this.bodyRemaining > 0 ? 1 : 0);
+  }
+}
+
+const cipherSuiteNames: Record<number, string> = {
+  0x1301: 'TLS_AES_128_GCM_SHA256',
+  0x1302: 'TLS_AES_256_GCM_SHA384',
+  0x1303: 'TLS_CHACHA20_POLY1305_SHA256',
+  0xc02b: 'TLS_ECDHE_ECDSA_WITH_AES_128_GCM_SHA256',
+  0xc02c: 'TLS_ECDHE_ECDSA_WITH_AES_256_GCM_SHA384',
+  0xc02f: 'TLS_ECDHE_RSA_WITH_AES_128_GCM_SHA256',
+  0xc030: 'TLS_ECDHE_RSA_WITH_AES_256_GCM_SHA384',
+  0xcca8: 'TLS_ECDHE_RSA_WITH_CHACHA20_POLY1305_SHA256',
+  0xcca9: 'TLS_ECDHE_ECDSA_WITH_CHACHA20_POLY1305_SHA256',
+};
+
+const protocolNames: Record<number, string> = { 0x0303: 'TLSv1.2', 0x0304: 'TLSv1.3' };
+
+const codePoint = (names: Record<number, string>, value: number) =>
+  value === 0 ? null : names[value] ?? `0x${value.toString(16).padStart(4, '0')}`;
+
+// in the order of the enum in src/stats.h
+const cryptoOps = ['aesGcmEncrypt', 'aesGcmDecrypt', 'sha', 'ecKeygen', 'ecdh'] as const;
+
+interface EngineStats {
+  suspensions: number;
+  networkReads: number;
+  networkBytes: number;
+  heapPeak: number;  // static-memory builds only (0 otherwise): the most wasm heap the connection held at once
+  heapAllocs: number;  // ... in how many allocations
+  crypto: Record<typeof cryptoOps[number], { calls: number, ms: number }>;
+}
+
+// reads the C side's TlsStats struct (see src/stats.h) out of wasm memory
+function readEngineStats(module: any, id: number): EngineStats {
+  const ptr = id < 0 ? 0 : module._tlsStats(id);
+  const view = new DataView(module.HEAPU8.buffer, ptr);
+  const counts = 8 * cryptoOps.length;  // after the doubles
+  const crypto = {} as EngineStats['crypto'];
+  cryptoOps.forEach((op, i) => crypto[op] = {
+    ms: ptr === 0 ? 0 : view.getFloat64(8 * i, true),
+    calls: ptr === 0 ? 0 : view.getUint32(counts + 4 * i, true),
+  });
+  const count = (i: number) => ptr === 0 ? 0 : view.getUint32(counts + 4 * (cryptoOps.length + i), true);
+  return { suspensions: count(0), networkReads: count(1), networkBytes: count(2), heapPeak: count(3), heapAllocs: count(4), crypto };
+}
+
+/**
+ * Per-connection counters from getStats(). Times are in ms, by performance.now() where available.
+ * Note that in Workers the clock only advances on I/O, so time spent purely computing (in wasm or
+ * WebCrypto) reads as zero there: handshakeComputeMs and crypto[op].ms are for local benchmarks.
+ */
+export interface TlsStats extends EngineStats {
+  moduleMs: number;  // getting the (possibly already instantiated) wasm module
+  wsUpgradeMs: number;  // the WebSocket upgrade request to the proxy, or opening a stream in a shared tunnel
+  handshakeMs: number;  // ClientHello to the handshake's completion
+  handshakeNetworkWaitMs: number;  // ... of which waiting for the server
+  handshakeComputeMs: number;  // ... and the rest, i.e. key exchange and certificate verification
+  protocol: string | null;
+  cipherSuite: string | null;
+  sessionReused: boolean;
+  recordsIn: number;  // TLS records, and the ciphertext bytes carrying them
+  bytesIn: number;
+  recordsOut: number;
+  bytesOut: number;
+  plaintextBytesIn: number;
+  plaintextBytesOut: number;
+  queue: { chunks: number, bytes: number, maxChunks: number, maxBytes: number };  // incoming messages not yet read
+  send: { bytesSent: number, bytesCopied: number, messagesSent: number };
+}
+
+export interface WsTlsOptions {
+  verbose?: boolean;
+  rootCert?: string;  // PEM: for WolfSSL, added to the built-in roots (in the static build, every connection must bring the same one, or none); for BearSSL, replaces them
+  readAhead?: boolean;  // WolfSSL WebCrypto build only: decrypt queued records in parallel (see jsInitAesKeyCache)
+  sessionStore?: SessionStore | null;  // defaults to defaultSessionStore; null disables resumption
+  coalesceWrites?: boolean;  // start corked, so that writes are flushed only when a read needs the reply
+  mux?: MuxTunnel | null;  // share this tunnel's WebSocket to the proxy, if the proxy multiplexes (see src/wsmux.ts)
+}
+
+interface ConnectionHooks {
+  provideEncryptedFromNetwork(buf: number, maxBytes: number): Promise<number>;
+  takeEncryptedFromNetwork(buf: number, maxBytes: number): number;
+  writeEncryptedToNetwork(buf: number, size: number): number;
+}
+
+/**
+ * A single instance of the emscripten module is shared by every connection in the isolate.
+ * Each connection gets an id from tlsOpen, and the C side passes that id back to us in its
+ * network callbacks, so we can route them to the right WebSocket.
+ */
+
+let modulePromise: Promise<any> | null = null;
+const connectionHooks = new Map<number, ConnectionHooks>();
+
+/**
+ * Where the WolfSSL WebCrypto build, and the BearSSL subtle build, do their symmetric crypto (see
+ * CryptoPolicy in src/wolfssl.c and src/bearssl.c): AES-GCM records and (WolfSSL only) hash messages
+ * at least as long as the thresholds go to WebCrypto, and shorter ones stay in wasm;
+ * ChaCha20-Poly1305, always in wasm, is offered first if preferChaCha. Unless
+ * pinned, it's calibrated when the module is instantiated. In Workers, where the clock doesn't
+ * advance during computation, calibration can't measure anything: it stops at its first (wasm-only)
+ * sample, and the built-in defaults stand.
+ */
+export interface CryptoPolicy {
+  aesOffloadThreshold: number;  // bytes; 2147483647 for never
+  shaOffloadThreshold: number;
+  preferChaCha: boolean;
+  calibrated: boolean;
+}
+
+type PinnedCryptoPolicy = Partial<Omit<CryptoPolicy, 'calibrated'>>;
+let pinnedCryptoPolicy: PinnedCryptoPolicy | null = null;
+
+// the C side's CryptoPolicy struct: four int32s, in this order
+const cryptoPolicyFields = ['aesOffloadThreshold', 'shaOffloadThreshold', 'preferChaCha', 'calibrated'] as const;
+
+function cryptoPolicyView(module: any) {
+  return new Int32Array(module.HEAPU8.buffer, module._tlsCryptoPolicy(), cryptoPolicyFields.length);
+}
+
+/** Sets the policy (or part of it), instead of calibrating: e.g. to values found by cryptoPolicy() locally. */
+export function pinCryptoPolicy(policy: PinnedCryptoPolicy) {
+  pinnedCryptoPolicy = policy;
+  modulePromise?.then(module => {
+    if (module._tlsCryptoPolicy !== undefined) writeCryptoPolicy(module, policy);
+  });
+}
+
+/** The policy in force (once the module is loaded), or null if this build has no WebCrypto offload. */
+export async function cryptoPolicy(verbose = false): Promise<CryptoPolicy | null> {
+  const module = await getModule(verbose);
+  if (module._tlsCryptoPolicy === undefined) return null;
+  const view = cryptoPolicyView(module);
+  const [aesOffloadThreshold, shaOffloadThreshold, preferChaCha, calibrated] = view;
+  return { aesOffloadThreshold, shaOffloadThreshold, preferChaCha: preferChaCha !== 0, calibrated: calibrated !== 0 };
+}
+
+function writeCryptoPolicy(module: any, policy: PinnedCryptoPolicy) {
+  const view = cryptoPolicyView(module);
+  cryptoPolicyFields.forEach((field, i) => {
+    if (field !== 'calibrated' && policy[field] !== undefined) view[i] = Number(policy[field]);
+  });
+}
+
+// ASYNCIFY supports only one suspended call into the module at once, so all (potentially)
+// suspending calls are queued here, whichever connection they're for
+let moduleQueue: Promise<unknown> = Promise.resolve();
+
+function enqueue<T>(fn: () => Promise<T>) {
+  const result = moduleQueue.then(fn);
+  moduleQueue = result.catch(() => { });
+  return result;
+}
+
+function getModule(verbose: boolean) {
+  if (modulePromise === null) modulePromise = tls_emscripten({
+    instantiateWasm(info: any, receive: any) {
+      if (verbose) console.log('loading wasm');
+
+      let instance = new WebAssembly.Instance(tlswasm, info);
+      receive(instance);
+
+      return instance.exports;
+    },
+
+    provideEncryptedFromNetwork(id: number, buf: number, maxBytes: number) {
+      return connectionHooks.get(id)!.provideEncryptedFromNetwork(buf, maxBytes);
+    },
+
+    takeEncryptedFromNetwork(id: number, buf: number, maxBytes: number) {
+      return connectionHooks.get(id)!.takeEncryptedFromNetwork(buf, maxBytes);
+    },
+
+    writeEncryptedToNetwork(id: number, buf: number, size: number) {
+      return connectionHooks.get(id)!.writeEncryptedToNetwork(buf, size);
+    },
+  }).then(async (module: any) => {
+    if (module._tlsCryptoPolicy !== undefined) {  // before any connection is opened, so the suite order applies
+      if (pinnedCryptoPolicy !== null) writeCryptoPolicy(module, pinnedCryptoPolicy);
+      else await enqueue(() => module.ccall('tlsCalibrate', 'number', [], [], { async: true }));
+      if (verbose) console.log('crypto policy', cryptoPolicyView(module));
+    }
+    return module;
+  });
+
+  return modulePromise;
+}
+
 /**
  * This object handles communication with an emscripten-compiled TLS library.
  * Data flow is somewhat complex, since we're turning new data events into async read calls,
  * and the read and write data paths can either go via the TLS library (after initTLS) or not.
+ *
+ * The library may be built in either of two modes. In the default (ASYNCIFY) mode, the C code
+ * calls back into JS for network data, but returns TLS_WANT_READ rather than suspend when there
+ * isn't any (see tlsSetNonBlocking), and JS waits for the next record to arrive before calling it
+ * again: it suspends only for WebCrypto. In the non-blocking mode
+ * (`./buildwolf.sh nonblocking` or `./buildbear.sh nonblocking`), we push ciphertext in as it
+ * arrives, pull ciphertext out after every call, and the C code returns TLS_WANT_READ when it
+ * needs more input, so nothing ever suspends.
  */
 
 export default (async function (
   host: string,
   port: number,
   wsProxy: string, // e.g. http://localhost:9090/
-  verbose = false,
+  { verbose = false, rootCert = '', readAhead = false, sessionStore = defaultSessionStore, coalesceWrites = false, mux = null }: WsTlsOptions = {},
 ) {
+  const sessionKey = `${host}:${port}`;
+  let sessionSaved = false;
   let tlsStarted = false;
+  let connectionId = -1;
+  let socketClosed = false;
 
   const incomingDataQueue: Uint8Array[] = [];
   let outstandingDataRequest: DataRequest | null = null;
-  let latestWritePromise = Promise.resolve(0);
+  // everyone waiting on the network: a read and a write may both be waiting at once, e.g. when a
+  // pipelined query's results are read while later queries are still being written
+  const networkWaiters: (() => void)[] = [];
+
+  // wasm-side buffer for outgoing plaintext, grown as needed and reused (not the stack, which a
+  // large coalesced write would overflow in the lean and static builds)
+  let writeBuf = 0, writeBufSize = 0;
+  let writeChain: Promise<unknown> = Promise.resolve();  // non-blocking mode's writes (see writeTls)
+
+  // TLS plaintext held back by cork()
+  let corked = coalesceWrites;
+  const heldWrites: Uint8Array[] = [];
+  let heldBytes = 0;
+
+  // bytesCopied counts copies out of wasm memory, so bytesCopied / bytesSent should never exceed 1
+  const sendStats = { bytesSent: 0, bytesCopied: 0, messagesSent: 0 };
+
+  // see getStats
+  const timings = { moduleMs: 0, wsUpgradeMs: 0, handshakeMs: 0, handshakeNetworkWaitMs: 0 };
+  let networkWaitMs = 0;
+  const recordsIn = new RecordCounter(), recordsOut = new RecordCounter();
+  let plaintextBytesIn = 0, plaintextBytesOut = 0;
+  let queueMaxChunks = 0, queueMaxBytes = 0;
+  let finalStats: Pick<TlsStats, keyof EngineStats | 'protocol' | 'cipherSuite' | 'sessionReused'> | null = null;
+
+  // decrypted bytes in the connection's wasm-side receive buffer (see readDataInPlace in the C code)
+  // that haven't been consumed yet, as an offset into module.HEAPU8
+  let plainOffset = 0, plainLength = 0;
+
+  // copies as much queued data as fits, across chunks, into wasm memory (once TLS has started) or a
+  // plain array, returning the number of bytes copied
+  function copyQueuedData(container: number | Uint8Array, maxBytes: number) {
+    let len = 0;
+    while (incomingDataQueue.length > 0 && len < maxBytes) {
+      let nextData = incomingDataQueue[0];
+      if (nextData.length > maxBytes - len) {
+        if (verbose) console.log('splitting next chunk');
+        incomingDataQueue[0] = nextData.subarray(maxBytes - len);
+        nextData = nextData.subarray(0, maxBytes - len);
+      } else {
+        incomingDataQueue.shift();
+      }
+
+      if (typeof container === 'number') module.HEAPU8.set(nextData, container + len);
+      else container.set(nextData, len);
+      len += nextData.length;
+    }
+
+    if (verbose) console.log(`${len} bytes dequeued`);
+    socket.consumed?.(len);  // for a MuxStream's flow control
+    return len;
+  }
 
   function dequeueIncomingData() {
     if (verbose) console.log('dequeue ...');
@@ -50,75 +402,212 @@ export default (async function (
       return;
     }
 
-    let nextData = incomingDataQueue[0];
     const { container, maxBytes, resolve } = outstandingDataRequest;
+    outstandingDataRequest = null;
+    resolve(copyQueuedData(container, maxBytes));
+  }
+
+  // resolves once there's something for a TLS read to work on, so that a read doesn't take a turn in
+  // the module queue only to find nothing there
+  function dataAvailable() {
+    if (incomingDataQueue.length > 0 || socketClosed || module._hasPending(connectionId)) return;
+    return waitForNetwork(new Promise<void>(resolve => networkWaiters.push(resolve)));
+  }
 
-    if (nextData.length > maxBytes) {
-      if (verbose) console.log('splitting next chunk');
-      incomingDataQueue[0] = nextData.subarray(maxBytes);
-      nextData = nextData.subarray(0, maxBytes);
+  // resolves when more ciphertext has arrived, or the socket has closed
+  function nextInput() {
+    if (socketClosed) return;
+    return waitForNetwork(new Promise<void>(resolve => networkWaiters.push(resolve)));
+  }
 
-    } else {
-      if (verbose) console.log('returning next chunk whole');
-      incomingDataQueue.shift();
+  // resolves once another record has fully arrived since there were `complete`, or the socket has closed
+  async function recordArrived(complete: number) {
+    while (recordsIn.complete <= complete && !socketClosed) await nextInput();
+  }
+
+  // ASYNCIFY mode: runs tlsConnect or readDataInPlace in the module queue, and again each time another
+  // record has arrived, for as long as it returns TLS_WANT_READ, so that the wait for the server
+  // happens outside the queue, and doesn't hold up other connections' calls into the module
+  async function runSteps(fn: 'tlsConnect' | 'readDataInPlace') {
+    for (;;) {
+      const complete = recordsIn.complete;
+      const status: number = await enqueue(() => module.ccall(fn, 'number', ['number'], [connectionId], { async: true }));
+      if (status !== TLS_WANT_READ) return status;
+      await recordArrived(complete);
     }
+  }
 
-    if (tlsStarted) {
-      if (verbose) console.log('providing data to wasm for decryption');
-      module.HEAPU8.set(nextData, container);  // copy data to appropriate memory range
+  async function waitForNetwork<T>(promise: Promise<T>) {
+    const started = now();
+    const result = await promise;
+    networkWaitMs += now() - started;
+    return result;
+  }
 
-    } else {
-      if (verbose) console.log('providing data direct');
-      (container as Uint8Array).set(nextData);
+  function feedEncrypted(data: Uint8Array) {
+    const buf = module._encryptedInputBuffer(connectionId, data.length);
+    module.HEAPU8.set(data, buf);
+    module._feedEncrypted(connectionId, data.length);
+  }
+
+  // data must not be a view of wasm memory, which may change or move once we return
+  function send(data: Uint8Array, copied: boolean) {
+    // e.g. an idle pooled connection the server has dropped: rather than throw (possibly through
+    // wasm), let the write vanish, and the next read will see EOF
+    if (socketClosed) return;
+    socket.send(data);
+    if (tlsStarted) recordsOut.add(data);
+    sendStats.bytesSent += data.length;
+    if (copied) sendStats.bytesCopied += data.length;
+    sendStats.messagesSent++;
+  }
+
+  function takeEncrypted() {
+    const len = module._pendingEncrypted(connectionId);
+    if (len === 0) return;
+
+    if (verbose) console.log(`takeEncrypted: writing ${len} bytes`);
+    const buf = module._encryptedOutputBuffer(connectionId);
+    send(module.HEAPU8.slice(buf, buf + len), true);
+    module._takeEncrypted(connectionId, len);
+  }
+
+  // called after reads, since TLS 1.3 session tickets arrive after the handshake
+  function saveSession() {
+    if (sessionSaved || sessionStore === null) return;
+
+    // one buffer per module, rather than a malloc per read until the ticket comes: it's copied out at once
+    const buf = module.sessionBuffer ??= module._malloc(MAX_SESSION_SIZE);
+    const len = module._tlsGetSession(connectionId, buf, MAX_SESSION_SIZE);
+    if (len > 0) {
+      if (verbose) console.log(`saving ${len}-byte TLS session`);
+      sessionSaved = true;
+      const session = module.HEAPU8.slice(buf, buf + len);
+      Promise.resolve(sessionStore.put(sessionKey, session)).catch(err => {
+        if (verbose) console.log('failed to save TLS session', err);
+      });
     }
+  }
 
-    outstandingDataRequest = null;
+  // encrypts and sends data: WolfSSL and BearSSL each split it into as few records as possible, and
+  // stage the resulting ciphertext so that it's sent as a single WebSocket message
+  function stageWrite(data: Uint8Array) {
+    if (data.length > writeBufSize) {
+      module._free(writeBuf);
+      writeBuf = module._malloc(writeBufSize = data.length);
+    }
+    module.HEAPU8.set(data, writeBuf);
+    return writeBuf;
+  }
 
-    const len = nextData.length;
-    if (verbose) console.log(`${len} bytes dequeued`);
+  async function writeNonBlocking(data: Uint8Array) {
+    if (verbose) console.log('non-blocking TLS writeData');
+    stageWrite(data);
+
+    let written = 0;
+    while (written < data.length) {
+      const status = module._writeData(connectionId, writeBuf + written, data.length - written);
+      if (status === TLS_WANT_READ) {
+        takeEncrypted();
+        await nextInput();
+        if (!tlsStarted) return -1;  // closed meanwhile, and writeBuf freed
+      }
+      else if (status === TLS_WANT_WRITE || status < 0) return -1;
+      else written += status;
+    }
+    takeEncrypted();
+    plaintextBytesOut += data.length;
+    return 0;
+  }
+
+  async function writeTls(data: Uint8Array) {
+    if (nonblocking) {
+      // one at a time, like the queued writes below, since one that waits has its data in writeBuf
+      const result = writeChain.then(() => writeNonBlocking(data));
+      writeChain = result.catch(() => { });
+      return result;
+    }
 
-    resolve(len);
+    if (verbose) console.log('TLS writeData');
+    // staged inside the queue, since the buffer is shared by this connection's writes
+    // both WolfSSL and BearSSL return the number of bytes written, which is all of them here
+    const status: number = await enqueue(() => module.ccall('writeData', 'number', ['number', 'number', 'number'], [connectionId, stageWrite(data), data.length], { async: true }));
+    if (status < 0) return -1;
+    plaintextBytesOut += data.length;
+    return 0;
   }
 
-  const wsAddr = `${wsProxy}?name=${host}:${port}`;
-  const [resp, module] = await Promise.all([
-    // start websocket connection
-    fetch(wsAddr, { headers: { Upgrade: 'websocket' } }),
+  async function flushWrites() {
+    if (heldBytes === 0) return 0;
+    if (verbose) console.log(`flushing ${heldBytes} bytes of coalesced writes`);
+
+    const data = concatChunks(heldWrites.splice(0), heldBytes);
+    heldBytes = 0;
+    return writeTls(data);
+  }
+
+  // refills the receive buffer once everything in it has been consumed, returning the number of bytes
+  // available, or 0 at EOF, or a negative error code
+  async function fillPlaintext() {
+    if (plainLength > 0) return plainLength;
+    if (await flushWrites() < 0) return -1;  // we're presumably waiting on a reply to these
+
+    let bytesRead;
+    if (nonblocking) {
+      if (verbose) console.log('non-blocking TLS readDataInPlace');
+      while ((bytesRead = module._readDataInPlace(connectionId)) === TLS_WANT_READ) {
+        takeEncrypted();
+        await nextInput();
+      }
+      takeEncrypted();
 
-    // init wasm module
-    tls_emscripten({
-      instantiateWasm(info: any, receive: any) {
-        if (verbose) console.log('loading wasm');
+    } else {
+      if (verbose) console.log('TLS readDataInPlace');
+      await dataAvailable();
+      bytesRead = await runSteps('readDataInPlace');
+    }
 
-        let instance = new WebAssembly.Instance(tlswasm, info);
-        receive(instance);
+    if (bytesRead > 0) {
+      plainOffset = module._readDataPointer(connectionId);
+      plainLength = bytesRead;
+      plaintextBytesIn += bytesRead;
+      saveSession();
+    }
+    return bytesRead as number;
+  }
 
-        return instance.exports;
-      },
+  function notifyDataArrived() {
+    for (const resolve of networkWaiters.splice(0)) resolve();
+  }
 
-      provideEncryptedFromNetwork(buf: number, maxBytes: number) {
-        if (verbose) console.log(`provideEncryptedFromNetwork: providing up to ${maxBytes} bytes`);
+  // a stream in a shared tunnel if we can, or else a WebSocket of our own
+  async function openSocket(): Promise<SocketLike> {
+    const stream = mux === null ? null : await mux.open(host, port);
+    if (stream !== null) return stream;
 
-        return new Promise(resolve => {
-          outstandingDataRequest = { container: buf, maxBytes, resolve };
-          dequeueIncomingData();
-        });
-      },
+    const resp = await fetch(`${wsProxy}?name=${host}:${port}`, { headers: { Upgrade: 'websocket' } });
+    const socket = resp.webSocket;
+    socket.accept();
+    socket.binaryType = 'arraybuffer';
+    return socket;
+  }
 
-      writeEncryptedToNetwork(buf: number, size: number) {
-        if (verbose) console.log(`writeEncryptedToNetwork: writing ${size} bytes`);
+  const started = now();
+  const [socket, module] = await Promise.all([
+    // start websocket connection
+    openSocket().then(socket => {
+      timings.wsUpgradeMs = now() - started;
+      return socket;
+    }),
 
-        const arr = module.HEAPU8.slice(buf, buf + size);
-        socket.send(arr);
-        
-        return size;
-      },
+    // init (or reuse) wasm module
+    getModule(verbose).then(module => {
+      timings.moduleMs = now() - started;
+      return module;
     }),
   ]);
-  
-  const socket = resp.webSocket;
-  socket.accept();
-  socket.binaryType = 'arraybuffer';
+
+  const nonblocking = module._feedEncrypted !== undefined;
 
   socket.addEventListener('error', (err: any) => {
     throw err;
@@ -126,54 +615,193 @@ export default (async function (
 
   socket.addEventListener('close', () => {
     if (verbose) console.log('socket: disconnected');
+    socketClosed = true;
+    if (nonblocking && tlsStarted) module._feedEncrypted(connectionId, 0);
     if (outstandingDataRequest) {
       // TODO: consider whether this is possible and, if so, whether this is the right way to handle it
       outstandingDataRequest.resolve(0);
       outstandingDataRequest = null;
     }
+    notifyDataArrived();
   });
 
   socket.addEventListener('message', (msg: any) => {
-    const data = new Uint8Array(msg.data);
+    const data = msg.data instanceof Uint8Array ? msg.data : new Uint8Array(msg.data);  // the former from a MuxStream
     if (verbose) console.log(`socket: ${data.length} bytes received`);
-    incomingDataQueue.push(data);
-    dequeueIncomingData();
+    if (tlsStarted) recordsIn.add(data);
+    if (nonblocking && tlsStarted) {
+      feedEncrypted(data);
+      socket.consumed?.(data.length);
+    } else {
+      if (readAhead && tlsStarted) module.readAheadChunk(connectionId, data);
+      incomingDataQueue.push(data);
+      queueMaxChunks = Math.max(queueMaxChunks, incomingDataQueue.length);
+      queueMaxBytes = Math.max(queueMaxBytes, queuedBytes());
+      dequeueIncomingData();
+    }
+    notifyDataArrived();
   });
 
+  const hooks: ConnectionHooks = {
+    provideEncryptedFromNetwork(buf: number, maxBytes: number) {
+      if (verbose) console.log(`provideEncryptedFromNetwork: providing up to ${maxBytes} bytes`);
+
+      return waitForNetwork(new Promise<number>(resolve => {
+        outstandingDataRequest = { container: buf, maxBytes, resolve };
+        dequeueIncomingData();
+      }));
+    },
+
+    // the synchronous counterpart, which the C side tries first, so as to suspend only when it must
+    takeEncryptedFromNetwork(buf: number, maxBytes: number) {
+      if (incomingDataQueue.length === 0) return socketClosed ? 0 : PLATFORM_WOULD_BLOCK;
+      return copyQueuedData(buf, maxBytes);
+    },
+
+    writeEncryptedToNetwork(buf: number, size: number) {
+      if (verbose) console.log(`writeEncryptedToNetwork: writing ${size} bytes`);
+
+      // the C code stages ciphertext and calls this once per flush, not once per record
+      send(module.HEAPU8.slice(buf, buf + size), true);
+
+      return size;
+    },
+  };
+
+  function queuedBytes() {
+    return incomingDataQueue.reduce((total, chunk) => total + chunk.length, 0);
+  }
+
+  function connectionStats() {
+    if (!tlsStarted) return finalStats;
+    return {
+      ...readEngineStats(module, connectionId),
+      protocol: codePoint(protocolNames, module._tlsProtocolVersion(connectionId)),
+      cipherSuite: codePoint(cipherSuiteNames, module._tlsCipherSuite(connectionId)),
+      sessionReused: module._tlsSessionReused(connectionId) === 1,
+    };
+  }
+
+  function closeConnection() {
+    if (tlsStarted) finalStats = connectionStats();  // the C side's counters go with the connection
+
+    if (tlsStarted && nonblocking) {
+      module._tlsShutdown(connectionId);
+      takeEncrypted();
+      socket.close();
+      module._tlsClose(connectionId);
+      module._free(writeBuf);
+      connectionHooks.delete(connectionId);
+      tlsStarted = false;
+      return;
+    }
+
+    socket.close();
+    if (tlsStarted) {
+      // queued so that we don't free the connection under an in-flight call
+      enqueue(async () => {
+        module._tlsClose(connectionId);
+        module._free(writeBuf);
+        connectionHooks.delete(connectionId);
+        tlsStarted = false;
+      });
+    }
+  }
+
   return {
-    async startTls() {
-      // note: WolfSSL handshakes right away; BearSSL only starts the handshake when we next read/write
-      // (that means some changes are needed for BearSSL, as this op is not async there)
+    // caCert (PEM) overrides the rootCert option, e.g. with a Postgres client's tls.caCertificates;
+    // alpn is a protocol name to offer, e.g. 'postgresql' (see alpnSelected)
+    async startTls(caCert = rootCert, alpn?: string) {
       if (verbose) console.log('initialising TLS');
+      const handshakeStarted = now();
+      const waitedBefore = networkWaitMs;
+      const handshakeDone = <T>(result: T) => {
+        timings.handshakeMs = now() - handshakeStarted;
+        timings.handshakeNetworkWaitMs = networkWaitMs - waitedBefore;
+        return result;
+      };
+
+      const rootCertData = new TextEncoder().encode(caCert);
+      connectionId = module.ccall('tlsOpen', 'number', ['string', 'array', 'number', 'number'], [host, rootCertData, rootCertData.length, 0]);
+      if (connectionId < 0) throw new Error('TLS connection could not be opened');
+
+      if (sessionStore !== null) {
+        // a failed lookup (e.g. a KV error) means a full handshake, rather than a leaked connection slot
+        let session: Uint8Array | null = null;
+        try {
+          session = await sessionStore.get(sessionKey);
+        } catch (err) {
+          if (verbose) console.log('failed to look up TLS session', err);
+        }
+        if (session) {
+          if (verbose) console.log('offering saved TLS session');
+          module.ccall('tlsSetSession', 'number', ['number', 'array', 'number'], [connectionId, session, session.length]);
+        }
+      }
+
+      if (alpn !== undefined && module.ccall('tlsSetAlpn', 'number', ['number', 'string'], [connectionId, alpn]) !== 0) {
+        module._tlsClose(connectionId);
+        throw new Error(`ALPN protocol ${alpn} could not be offered`);
+      }
+
+      connectionHooks.set(connectionId, hooks);
       tlsStarted = true;
-      const result = await module.ccall('initTls', 'number', ['string'], [host], { async: true });
-      return result;
+      module._tlsSetNonBlocking?.(connectionId, 1);  // see runSteps
+
+      if (readAhead && module.readAheadStart === undefined) {
+        if (verbose) console.log('read-ahead is not supported by this build');
+        readAhead = false;
+      }
+      if (readAhead) {
+        module.readAheadStart(connectionId);
+        for (const data of incomingDataQueue) module.readAheadChunk(connectionId, data);
+      }
+
+      if (nonblocking) {
+        for (const data of incomingDataQueue.splice(0)) feedEncrypted(data);
+
+        let status;
+        while ((status = module._tlsConnect(connectionId)) === TLS_WANT_READ) {
+          takeEncrypted();
+          await nextInput();
+        }
+        takeEncrypted();
+        return handshakeDone(status);
+      }
+
+      // both WolfSSL and BearSSL complete the handshake here, in steps, as the server's records arrive
+      return handshakeDone(await runSteps('tlsConnect'));
     },
 
     async writeData(data: Uint8Array) {
-      if (tlsStarted) {
-        if (verbose) console.log('TLS writeData');
-        latestWritePromise = module.ccall('writeData', 'number', ['array', 'number'], [data, data.length], { async: true });
-        const status = await latestWritePromise;
-        return status as 0 | -1;
+      if (tlsStarted && corked) {
+        if (verbose) console.log(`holding back ${data.length} bytes`);
+        heldWrites.push(data.slice());  // the caller may reuse its buffer
+        heldBytes += data.length;
+        if (heldBytes >= COALESCE_THRESHOLD) return flushWrites();
+        return 0;
+
+      } else if (tlsStarted) {
+        return writeTls(data);
 
       } else {
         if (verbose) console.log('raw writeData');
-        socket.send(data);
+        send(data, false);
         return 0;
       }
     },
 
     async readData(data: Uint8Array) {
-      await latestWritePromise;  // must ensure we don't read before writes are finished to avoid empscripten reentrancy
       const maxBytes = data.length;
-      
+
       if (tlsStarted) {
-        if (verbose) console.log('TLS readData');
-        const buf = module._malloc(maxBytes);
-        const bytesRead = await module.ccall('readData', 'number', ['number', 'number'], [buf, maxBytes], { async: true });
-        data.set(module.HEAPU8.subarray(buf, buf + bytesRead));
-        module._free(buf);
+        const bytesAvailable = await fillPlaintext();
+        if (bytesAvailable <= 0) return bytesAvailable;
+
+        const bytesRead = Math.min(maxBytes, bytesAvailable);
+        data.set(module.HEAPU8.subarray(plainOffset, plainOffset + bytesRead));
+        plainOffset += bytesRead;
+        plainLength -= bytesRead;
         return bytesRead;
 
       } else {
@@ -185,9 +813,73 @@ export default (async function (
       }
     },
 
+    // while corked, TLS writes are buffered until a read, a full record's worth, uncork() or close()
+    cork() {
+      corked = true;
+    },
+
+    async uncork() {
+      corked = false;
+      return flushWrites();
+    },
+
+    // TLS only: like readData, but without the copy -- returns a view of wasm memory holding the
+    // plaintext at [offset, offset + length), valid until the next read on this connection; length is
+    // 0 at EOF, or negative on error (the view is module.HEAPU8, which Emscripten re-creates when
+    // memory grows, so don't keep it across calls into the module, except in a static-memory build)
+    async readDataInPlace() {
+      const length = await fillPlaintext();
+      const offset = plainOffset;
+      if (length > 0) {
+        plainOffset += length;
+        plainLength = 0;
+      }
+      return { view: module.HEAPU8 as Uint8Array, offset, length };
+    },
+
+    // true if the server accepted the session we offered from sessionStore
+    sessionReused() {
+      return tlsStarted && module._tlsSessionReused(connectionId) === 1;
+    },
+
+    // true if the server picked the ALPN protocol offered to startTls
+    alpnSelected() {
+      return tlsStarted && module._tlsAlpnSelected(connectionId) === 1;
+    },
+
+    sendStats() {
+      return { ...sendStats };
+    },
+
+    // see TlsStats: cheap enough to call (and log) once per request
+    getStats(): TlsStats {
+      const engine = connectionStats() ?? { ...readEngineStats(module, -1), protocol: null, cipherSuite: null, sessionReused: false };
+      return {
+        ...timings,
+        handshakeComputeMs: timings.handshakeMs - timings.handshakeNetworkWaitMs,
+        ...engine,
+        recordsIn: recordsIn.records,
+        bytesIn: recordsIn.bytes,
+        recordsOut: recordsOut.records,
+        bytesOut: recordsOut.bytes,
+        plaintextBytesIn,
+        plaintextBytesOut,
+        queue: { chunks: incomingDataQueue.length, bytes: queuedBytes(), maxChunks: queueMaxChunks, maxBytes: queueMaxBytes },
+        send: { ...sendStats },
+      };
+    },
+
+    // WolfSSL WebCrypto build only: how many AES-GCM keys were imported vs. reused from the cache
+    // (a long-lived connection should show one import per direction, plus one per KeyUpdate), and
+    // how many records were or weren't already decrypted by read-ahead when WolfSSL asked for them
+    aesKeyStats(): { imports: number, reuses: number, readAheadHits: number, readAheadMisses: number } {
+      return module.aesKeyStats?.get(connectionId) ?? { imports: 0, reuses: 0, readAheadHits: 0, readAheadMisses: 0 };
+    },
+
     close() {
       if (verbose) console.log('requested close');
-      socket.close();
-    }
+      if (heldBytes > 0) flushWrites().finally(closeConnection);
+      else closeConnection();
+    },
   };
 });